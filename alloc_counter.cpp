@@ -0,0 +1,149 @@
+// Replacement global allocation functions that count calls and bytes, for benchmarks
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#ifdef _WIN32
+#include <malloc.h>
+#endif
+
+#include "bench.hpp"
+
+namespace {
+// relaxed is enough: we only read these between measurements
+std::atomic<std::size_t> alloc_count{0};
+std::atomic<std::size_t> alloc_bytes{0};
+}
+
+bench::alloc_stats bench::allocations() noexcept {
+    return alloc_stats{alloc_count.load(std::memory_order_relaxed),
+                       alloc_bytes.load(std::memory_order_relaxed)};
+}
+
+void* operator new(std::size_t sz) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+    if (void* p = std::malloc(sz ? sz : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t sz) {
+    return operator new(sz);
+}
+
+void* operator new(std::size_t sz, std::nothrow_t const&) noexcept {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+    return std::malloc(sz ? sz : 1);
+}
+
+void* operator new[](std::size_t sz, std::nothrow_t const& nt) noexcept {
+    return operator new(sz, nt);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+void operator delete[](void* p, std::size_t) noexcept {
+    std::free(p);
+}
+
+//
+// Over-aligned types (alignas beyond the default) come through these
+//
+
+namespace {
+
+void* aligned_malloc(std::size_t sz, std::align_val_t al) noexcept {
+    auto align = static_cast<std::size_t>(al);
+    // aligned_alloc wants a size that is a multiple of the alignment
+    sz = (sz ? sz : 1) + align - 1;
+    sz -= sz % align;
+#ifdef _WIN32
+    return _aligned_malloc(sz, align);
+#else
+    return std::aligned_alloc(align, sz);
+#endif
+}
+
+void aligned_free(void* p) noexcept {
+#ifdef _WIN32
+    _aligned_free(p);
+#else
+    std::free(p);
+#endif
+}
+
+}
+
+void* operator new(std::size_t sz, std::align_val_t al) {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+    if (void* p = aligned_malloc(sz, al)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new[](std::size_t sz, std::align_val_t al) {
+    return operator new(sz, al);
+}
+
+void* operator new(std::size_t sz, std::align_val_t al, std::nothrow_t const&) noexcept {
+    alloc_count.fetch_add(1, std::memory_order_relaxed);
+    alloc_bytes.fetch_add(sz, std::memory_order_relaxed);
+    return aligned_malloc(sz, al);
+}
+
+void* operator new[](std::size_t sz, std::align_val_t al, std::nothrow_t const& nt) noexcept {
+    return operator new(sz, al, nt);
+}
+
+void operator delete(void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
+
+void operator delete[](void* p, std::size_t, std::align_val_t) noexcept {
+    aligned_free(p);
+}
@@ -0,0 +1,119 @@
+// Micro-benchmarks for the Asio versions of the callback and coroutine examples
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Companion to coro_bench.cpp, using the awaitable from asio_coro.cpp.
+// The 50ms timer in that example is replaced with a post() so we measure the
+// machinery rather than the timer.
+//
+// usage: abench [iterations]
+
+#include <iostream>
+
+#include <experimental/coroutine>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "bench.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::co_spawn;
+using boost::asio::io_context;
+using boost::asio::use_awaitable;
+namespace this_coro = boost::asio::this_coro;
+
+namespace detail {
+static volatile int sink = 0;
+}
+
+awaitable<int> multiply(int x, int y) {
+    // suspend and resume from the run queue
+    co_await boost::asio::post(co_await this_coro::executor, use_awaitable);
+    co_return x * y;
+}
+
+awaitable<void> muladd(int c) {
+    int product = co_await multiply(2, 3);
+    detail::sink = product + c;
+}
+
+// one co_spawn per computation
+void coroutine_muladd(std::size_t n) {
+    io_context io;
+    for (std::size_t i = 0; i < n; ++i) {
+        co_spawn(io, muladd(static_cast<int>(i)), boost::asio::detached);
+    }
+    io.run();
+}
+
+// the callback equivalent: post the multiply, then post the add
+void callback_muladd(std::size_t n) {
+    io_context io;
+    for (std::size_t i = 0; i < n; ++i) {
+        boost::asio::post(io, [&io, c = static_cast<int>(i)]() {
+                int product = 2 * 3;
+                boost::asio::post(io, [product, c]() { detail::sink = product + c; });
+            });
+    }
+    io.run();
+}
+
+// task hop: a single coroutine suspending and resuming through the io_context
+awaitable<void> hop_loop(std::size_t n) {
+    auto ex = co_await this_coro::executor;
+    for (std::size_t i = 0; i < n; ++i) {
+        co_await boost::asio::post(ex, use_awaitable);
+    }
+}
+
+void coroutine_hops(std::size_t n) {
+    io_context io;
+    co_spawn(io, hop_loop(n), boost::asio::detached);
+    io.run();
+}
+
+void callback_hops(std::size_t n) {
+    struct hopper {
+        io_context* io;
+        std::size_t remaining;
+        void operator()() {
+            if (--remaining != 0) {
+                boost::asio::post(*io, *this);
+            }
+        }
+    };
+    io_context io;
+    boost::asio::post(io, hopper{&io, n});
+    io.run();
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 1000000);
+
+    bench::report(std::cout, bench::measure("muladd/callback_asio",  n, callback_muladd));
+    bench::report(std::cout, bench::measure("muladd/coroutine_asio", n, coroutine_muladd));
+    bench::report(std::cout, bench::measure("hop/callback_asio",     n, callback_hops));
+    bench::report(std::cout, bench::measure("hop/coroutine_asio",    n, coroutine_hops));
+}
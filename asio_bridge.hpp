@@ -0,0 +1,194 @@
+// Connecting Asio with the coroutine types and run queue in this repo
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ASIO_BRIDGE_HPP
+#define ASIO_BRIDGE_HPP
+
+// Two pieces:
+// 1) run_queue_context, which makes a run_queue usable as an Asio executor,
+//    so Asio handlers and co_spawned awaitables run on the same loop as everything else
+// 2) use_resume, a completion token that turns any Asio async operation into
+//    something our own coroutine types (await_return_object, qtcoro::return_object)
+//    can co_await. The completion handler resumes the coroutine right where
+//    Asio invokes it, without posting again.
+
+#include <memory>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <experimental/coroutine>
+
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/execution.hpp>
+#include <boost/asio/execution_context.hpp>
+
+#include "run_queue.hpp"
+
+//
+// run_queue as an Asio execution context
+// Asio needs an execution_context to attach services to; this one just
+// refers to the run_queue that does the actual work.
+// Like run_queue itself, this is single-threaded: submit work only from
+// the thread calling run_queue::run()
+//
+
+struct run_queue_context : boost::asio::execution_context {
+    explicit run_queue_context(run_queue& q) : queue_(q) {}
+
+    run_queue& queue() noexcept { return queue_; }
+
+    struct executor_type {
+        explicit executor_type(run_queue_context& ctx) noexcept : ctx_(&ctx) {}
+
+        run_queue_context& query(boost::asio::execution::context_t) const noexcept {
+            return *ctx_;
+        }
+
+        // tasks always go to the back of the queue; we never run them inline
+        static constexpr boost::asio::execution::blocking_t
+        query(boost::asio::execution::blocking_t) noexcept {
+            return boost::asio::execution::blocking.never;
+        }
+
+        template<typename F>
+        void execute(F&& f) const {
+            using fn_t = std::decay_t<F>;
+            if constexpr (std::is_copy_constructible_v<fn_t>) {
+                ctx_->queue().add_task([fn = fn_t(std::forward<F>(f))](run_queue*) mutable { fn(); });
+            } else {
+                // run_queue tasks are std::functions, which must be copyable,
+                // but Asio handlers (co_spawn's in particular) are often move-only
+                auto fn = std::make_shared<fn_t>(std::forward<F>(f));
+                ctx_->queue().add_task([fn](run_queue*) { (*fn)(); });
+            }
+        }
+
+        friend bool operator==(executor_type const& a, executor_type const& b) noexcept {
+            return a.ctx_ == b.ctx_;
+        }
+        friend bool operator!=(executor_type const& a, executor_type const& b) noexcept {
+            return a.ctx_ != b.ctx_;
+        }
+
+    private:
+        run_queue_context* ctx_;
+    };
+
+    executor_type get_executor() noexcept { return executor_type(*this); }
+
+private:
+    run_queue& queue_;
+};
+
+//
+// Completion token for co_await-ing Asio operations from our coroutine types
+// usage: auto ec = co_await timer.async_wait(use_resume);
+//
+
+struct use_resume_t {};
+constexpr use_resume_t use_resume{};
+
+namespace detail {
+
+// as in qtcoro: no completion arguments gives void, one gives that type,
+// and more than one gives a tuple
+template<typename... Args>
+struct resume_result {
+    using type = std::tuple<Args...>;
+    static type get(std::tuple<Args...>&& t) { return std::move(t); }
+};
+
+template<typename Arg>
+struct resume_result<Arg> {
+    using type = Arg;
+    static type get(std::tuple<Arg>&& t) { return std::get<0>(std::move(t)); }
+};
+
+template<>
+struct resume_result<> {
+    using type = void;
+    static void get(std::tuple<>&&) {}
+};
+
+}
+
+// The awaiter returned by an Asio initiating function called with use_resume.
+// The operation is not started until we have the coroutine handle, so there
+// is no race between completion and suspension. Results are stored here,
+// in the awaiting coroutine's frame.
+template<typename Initiation, typename InitArgs, typename... Results>
+struct asio_resume_awaiter {
+    asio_resume_awaiter(Initiation init, InitArgs args)
+        : init_(std::move(init)), args_(std::move(args)) {}
+
+    // the completion handler Asio will call
+    struct handler {
+        asio_resume_awaiter* awaiter_;
+
+        void operator()(Results... results) {
+            awaiter_->results_.emplace(std::move(results)...);
+            awaiter_->coro_.resume();
+        }
+    };
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename P>
+    void await_suspend(std::experimental::coroutine_handle<P> coro) {
+        coro_ = coro;
+        std::apply([this](auto&&... args) {
+                std::move(init_)(handler{this}, std::move(args)...);
+            }, std::move(args_));
+    }
+
+    typename detail::resume_result<Results...>::type await_resume() {
+        return detail::resume_result<Results...>::get(std::move(*results_));
+    }
+
+private:
+    Initiation init_;
+    InitArgs args_;
+    std::optional<std::tuple<Results...>> results_;
+    std::experimental::coroutine_handle<> coro_;
+};
+
+namespace boost {
+namespace asio {
+
+template<typename R, typename... Args>
+struct async_result<use_resume_t, R(Args...)> {
+    template<typename Initiation, typename... InitArgs>
+    static auto initiate(Initiation&& init, use_resume_t, InitArgs&&... args) {
+        return asio_resume_awaiter<std::decay_t<Initiation>,
+                                   std::tuple<std::decay_t<InitArgs>...>,
+                                   std::decay_t<Args>...>(
+                                       std::forward<Initiation>(init),
+                                       std::make_tuple(std::forward<InitArgs>(args)...));
+    }
+};
+
+}
+}
+
+#endif // ASIO_BRIDGE_HPP
@@ -26,39 +26,280 @@ SOFTWARE.
 // In a way this is a combination of the original callback example (with
 // lame hand-crafted run queue) and the co_awaited multiply (handled
 // synchronously) in cb_as_coro.cpp.
+//
+// usage: ac                      single io_context, as described above
+//        ac --shards N           muladds spread over N pinned io_contexts
+//                                (N = 0 means one per core)
+//        ac --load               load harness; reports throughput, latency, and memory
+//
+// other options, for --shards and --load:
+//        --requests R            total number of muladds (default 100000)
+//        --concurrency C         muladds in flight at once, for --load (default 1000)
+//        --latency SPEC          the multiply delay, for --load, in microseconds:
+//                                fixed:US, uniform:LO:HI, or exp:MEAN (default fixed:50000)
 
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
 #include <iostream>
+#include <random>
+#include <string>
+#include <vector>
 
 #include <experimental/coroutine>
 #include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
 #include <boost/asio/io_context.hpp>
 #include <boost/asio/steady_timer.hpp>
 #include <boost/asio/use_awaitable.hpp>
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#endif
+
+#include "histogram.hpp"
+#include "io_context_pool.hpp"
+
 using boost::asio::awaitable;
 using boost::asio::co_spawn;
 using boost::asio::io_context;
 namespace this_coro = boost::asio::this_coro;
 
-awaitable<int> multiply(int x, int y) {
+awaitable<int> multiply(int x, int y,
+                        std::chrono::microseconds delay = std::chrono::milliseconds(50)) {
     // arbitrary async operation so we suspend and resume from the run queue
     auto token = co_await this_coro::executor_t();
-    boost::asio::steady_timer t(token,
-                                boost::asio::chrono::milliseconds(50));
+    boost::asio::steady_timer t(token, delay);
     co_await t.async_wait(boost::asio::use_awaitable);  // suspend and run something else
     co_return x * y;
 }
 
-awaitable<int> muladd() {
+awaitable<int> muladd(std::chrono::microseconds delay = std::chrono::milliseconds(50)) {
     int a = 2;
     int b = 3;
     int c = 4;
-    int product = co_await multiply(a, b);           // runs directly, not through io_context
+    int product = co_await multiply(a, b, delay);    // runs directly, not through io_context
     int result = product + c;
     co_return result;
 }
 
-int main() {
+struct options {
+    bool        load = false;
+    std::size_t shards = 1;
+    std::size_t requests = 100000;
+    std::size_t concurrency = 1000;
+    std::string latency = "fixed:50000";
+};
+
+// Sharded mode: each coroutine is spawned on a shard chosen round-robin and
+// stays there, since multiply() takes its executor from this_coro::executor
+int run_sharded(options const& opts) {
+    io_context_pool pool(opts.shards);
+    std::atomic<std::size_t> completed{0};
+    std::atomic<long> total{0};
+
+    for (std::size_t i = 0; i < opts.requests; ++i) {
+        co_spawn(pool.next(),
+                 [](){ return muladd(); },
+                 [&](std::exception_ptr, int result) {
+                     completed.fetch_add(1, std::memory_order_relaxed);
+                     total.fetch_add(result, std::memory_order_relaxed);
+                 });
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pool.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << completed << " muladds on " << pool.size() << " shards in "
+              << elapsed.count() << "s, result sum: " << total << "\n";
+    return 0;
+}
+
+//
+// Load harness
+//
+
+// the distribution of multiply delays, replacing the fixed 50ms
+struct latency_spec {
+    enum { fixed, uniform, exponential } kind = fixed;
+    double a = 50000;       // fixed value, lower bound, or mean, in us
+    double b = 50000;       // upper bound for uniform
+
+    static bool parse(std::string const& s, latency_spec& spec) {
+        auto colon = s.find(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        std::string kind = s.substr(0, colon);
+        char* end = nullptr;
+        spec.a = std::strtod(s.c_str() + colon + 1, &end);
+        spec.b = spec.a;
+        if (kind == "fixed") {
+            spec.kind = fixed;
+        } else if (kind == "exp") {
+            spec.kind = exponential;
+        } else if (kind == "uniform" && *end == ':') {
+            spec.kind = uniform;
+            spec.b = std::strtod(end + 1, nullptr);
+        } else {
+            return false;
+        }
+        return spec.a >= 0 && spec.b >= spec.a;
+    }
+
+    template<typename Rng>
+    std::chrono::microseconds sample(Rng& rng) const {
+        double us = a;
+        if (kind == uniform) {
+            us = std::uniform_real_distribution<double>(a, b)(rng);
+        } else if (kind == exponential && a > 0) {
+            us = std::exponential_distribution<double>(1.0 / a)(rng);
+        }
+        return std::chrono::microseconds(static_cast<std::int64_t>(us));
+    }
+};
+
+// everything a load worker touches, one per shard so that
+// recording needs no synchronization
+struct load_shard {
+    latency_histogram latency;        // muladd start to completion, ns
+    latency_histogram resume_delay;   // completion time beyond the requested delay, ns
+    std::mt19937_64   rng;
+    long              checksum = 0;
+};
+
+// One of "concurrency" coroutines, each running muladds back to back
+// until the shared request budget is used up
+awaitable<void> load_worker(load_shard& shard, latency_spec spec,
+                            std::atomic<std::int64_t>& remaining) {
+    while (remaining.fetch_sub(1, std::memory_order_relaxed) > 0) {
+        auto delay = spec.sample(shard.rng);
+        auto start = std::chrono::steady_clock::now();
+        int result = co_await muladd(delay);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+        auto late = std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed - delay).count();
+        shard.latency.record(static_cast<std::uint64_t>(ns));
+        shard.resume_delay.record(static_cast<std::uint64_t>(std::max<std::int64_t>(late, 0)));
+        shard.checksum += result;
+    }
+}
+
+// peak resident set size in KiB, or 0 where we don't know how to get it
+long peak_rss_kib() {
+#if defined(__unix__) || defined(__APPLE__)
+    rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+#if defined(__APPLE__)
+    return usage.ru_maxrss / 1024;    // bytes on macOS
+#else
+    return usage.ru_maxrss;
+#endif
+#else
+    return 0;
+#endif
+}
+
+void print_percentiles(char const* title, latency_histogram const& h) {
+    std::cout << title << " (us): p50 " << h.percentile(50) / 1000.0
+              << "  p99 " << h.percentile(99) / 1000.0
+              << "  p99.9 " << h.percentile(99.9) / 1000.0
+              << "  max " << h.max() / 1000.0 << "\n";
+}
+
+int run_load(options const& opts) {
+    latency_spec spec;
+    if (!latency_spec::parse(opts.latency, spec)) {
+        std::cerr << "bad latency specification: " << opts.latency << "\n";
+        return 1;
+    }
+
+    io_context_pool pool(opts.shards);
+    std::vector<load_shard> shards(pool.size());
+    for (std::size_t i = 0; i < shards.size(); ++i) {
+        shards[i].rng.seed(i + 1);
+    }
+    std::atomic<std::int64_t> remaining{static_cast<std::int64_t>(opts.requests)};
+
+    long rss_before = peak_rss_kib();
+    auto start = std::chrono::steady_clock::now();
+    for (std::size_t i = 0; i < opts.concurrency; ++i) {
+        co_spawn(pool.shard(i), load_worker(shards[i % shards.size()], spec, remaining),
+                 boost::asio::detached);
+    }
+    pool.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+    long rss_after = peak_rss_kib();
+
+    latency_histogram latency, resume_delay;
+    for (auto const& s : shards) {
+        latency.merge(s.latency);
+        resume_delay.merge(s.resume_delay);
+    }
+
+    std::cout << latency.count() << " muladds, concurrency " << opts.concurrency
+              << ", " << pool.size() << " shards, latency " << opts.latency << "\n";
+    std::cout << "throughput: " << latency.count() / elapsed.count() << " muladds/s\n";
+    print_percentiles("latency", latency);
+    print_percentiles("resume delay", resume_delay);
+    std::cout << "peak RSS: " << rss_after << " KiB";
+    if (opts.concurrency != 0 && rss_after > rss_before) {
+        std::cout << " (~" << (rss_after - rss_before) * 1024 / static_cast<long>(opts.concurrency)
+                  << " bytes per suspended coroutine)";
+    }
+    std::cout << "\n";
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1) {
+        options opts;
+        bool sharded = false;
+        char const* for_any_mode = nullptr;     // the last option given that needs --shards or --load
+        char const* for_load = nullptr;         // ... or that needs --load
+        for (int i = 1; i < argc; ++i) {
+            std::string arg = argv[i];
+            bool has_value = i + 1 < argc;
+            if (arg == "--load") {
+                opts.load = true;
+            } else if (arg == "--shards" && has_value) {
+                sharded = true;
+                opts.shards = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--requests" && has_value) {
+                for_any_mode = argv[i];
+                opts.requests = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--concurrency" && has_value) {
+                for_load = argv[i];
+                opts.concurrency = std::strtoull(argv[++i], nullptr, 10);
+            } else if (arg == "--latency" && has_value) {
+                for_load = argv[i];
+                opts.latency = argv[++i];
+            } else {
+                std::cerr << "unknown or incomplete option: " << arg << "\n";
+                return 1;
+            }
+        }
+        // rather than quietly ignore them
+        if (for_load && !opts.load) {
+            std::cerr << for_load << " is only for --load\n";
+            return 1;
+        }
+        if (for_any_mode && !opts.load && !sharded) {
+            std::cerr << for_any_mode << " is only for --shards or --load\n";
+            return 1;
+        }
+        if (opts.load) {
+            return run_load(opts);
+        }
+        if (sharded) {
+            return run_sharded(opts);
+        }
+    }
+
     io_context io;
 
     // our main work
@@ -0,0 +1,93 @@
+// Asio operations and awaitables on the repo's own run queue and coroutine types
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// compute a*b+c in an await_return_object coroutine (as in cb_as_coro.cpp)
+// but get the product from Asio: first from an Asio-style async operation,
+// then from an Asio awaitable (as in asio_coro.cpp). Everything, including
+// the Asio handlers, runs on a single run_queue (as in callbacks.cpp).
+
+#include <iostream>
+
+#include <experimental/coroutine>
+#include <boost/asio/async_result.hpp>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/post.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "asio_bridge.hpp"
+#include "co_awaiter.hpp"
+#include "run_queue.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::co_spawn;
+using boost::asio::use_awaitable;
+namespace this_coro = boost::asio::this_coro;
+
+// our multiply written as an Asio asynchronous operation,
+// so it works with any completion token
+template<typename Executor, typename CompletionToken>
+auto async_multiply(Executor ex, int a, int b, CompletionToken&& token) {
+    return boost::asio::async_initiate<CompletionToken, void(int)>(
+        [ex](auto handler, int x, int y) {
+            boost::asio::post(ex, [handler = std::move(handler), x, y]() mutable {
+                    handler(x * y);
+                });
+        }, token, a, b);
+}
+
+// an Asio coroutine using it
+awaitable<int> asio_multiply(int x, int y) {
+    co_return co_await async_multiply(co_await this_coro::executor, x, y, use_awaitable);
+}
+
+await_return_object<> muladd(run_queue_context::executor_type ex) {
+    int a = 2;
+    int b = 3;
+    int c = 4;
+
+    // an Asio async operation, awaited directly
+    int product = co_await async_multiply(ex, a, b, use_resume);
+    std::cout << "result: " << product + c << "\n";
+
+    // an Asio awaitable: co_spawn it onto the same run queue and await its completion
+    auto [e, product2] = co_await co_spawn(ex, asio_multiply(a, b), use_resume);
+    if (!e) {
+        std::cout << "result from Asio coroutine: " << product2 + c << "\n";
+    }
+}
+
+int main() {
+    run_queue work;
+    work.enable_metrics(1);     // time every task; there are only a handful
+    run_queue_context ctx(work);
+
+    auto coro = muladd(ctx.get_executor());
+
+    // other work on the same queue, which runs between the coroutine's two awaits
+    boost::asio::post(ctx.get_executor(), []() { std::cout << "intermediate run queue task\n"; });
+
+    work.run();
+
+    std::cout << "run queue metrics: ";
+    report(std::cout, work.snapshot());
+}
@@ -0,0 +1,193 @@
+// Single-use events and one-value channels for coroutines, without locks or allocation
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ASYNC_EVENT_HPP
+#define ASYNC_EVENT_HPP
+
+// async_event: any number of coroutines co_await it; set() (from any
+// thread) resumes them all, and later awaits complete immediately.
+//
+// oneshot<T>: one value (or exception) passed from a producer on any thread
+// to one awaiting coroutine, e.g. the response to a request. The oneshot
+// lives where the consumer puts it, typically in the awaiting coroutine's
+// frame; the producer gets a sender(), which is just a pointer to it.
+//
+// Each is one atomic word of state, plus the value storage for oneshot:
+// no mutex, condition variable, or reference count, and nothing allocated.
+// The word holds "not yet", "done", or the address of the waiting coroutine
+// (for async_event, of the most recent awaiter, which links to the others).
+// Waiters are resumed right away on the thread that completes them.
+// The object must outlive the completion, and a coroutine must not be
+// destroyed while awaiting one. Unlike set(), a oneshot is completed exactly
+// once: a second set_value or set_exception would race with the consumer
+// for the value, and is caught by an assert in debug builds.
+
+#include <atomic>
+#include <cassert>
+#include <cstdint>
+#include <exception>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <experimental/coroutine>
+
+struct async_event {
+    async_event() = default;
+    async_event(async_event const&) = delete;
+
+    bool is_set() const noexcept {
+        return state_.load(std::memory_order_acquire) == set_state;
+    }
+
+    void set() {
+        auto old = state_.exchange(set_state, std::memory_order_acq_rel);
+        if (old == set_state) {
+            return;
+        }
+        // resume everyone who was waiting (most recent first)
+        auto* w = reinterpret_cast<awaiter*>(old);
+        while (w) {
+            auto* next = w->next_;  // w is gone once its coroutine continues
+            w->coro_.resume();
+            w = next;
+        }
+    }
+
+    struct awaiter {
+        async_event* event_;
+        awaiter* next_ = nullptr;
+        std::experimental::coroutine_handle<> coro_;
+
+        bool await_ready() const noexcept { return event_->is_set(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) noexcept {
+            coro_ = coro;
+            auto state = event_->state_.load(std::memory_order_acquire);
+            do {
+                if (state == set_state) {
+                    return false;
+                }
+                next_ = reinterpret_cast<awaiter*>(state);
+            } while (!event_->state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(this),
+                                                           std::memory_order_release,
+                                                           std::memory_order_acquire));
+            return true;
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    awaiter operator co_await () noexcept { return awaiter{this, nullptr, {}}; }
+
+private:
+    static constexpr std::uintptr_t set_state = 1;
+    // otherwise: 0 for no waiters, or the most recent waiter
+
+    std::atomic<std::uintptr_t> state_{0};
+};
+
+namespace detail {
+
+template<typename T>
+struct oneshot_value {
+    using type = T;
+};
+
+// an empty stand-in, so oneshot<void> stores the same way
+template<>
+struct oneshot_value<void> {
+    struct type {};
+};
+
+}
+
+template<typename T = void>
+struct oneshot {
+    oneshot() = default;
+    oneshot(oneshot const&) = delete;
+
+    // what the producer holds
+    struct sender_t {
+        template<typename... Args>
+        void set_value(Args&&... args) const {
+            o_->value_.template emplace<1>(std::forward<Args>(args)...);
+            o_->complete();
+        }
+
+        void set_exception(std::exception_ptr e) const {
+            o_->value_.template emplace<2>(std::move(e));
+            o_->complete();
+        }
+
+        oneshot* o_;
+    };
+
+    sender_t sender() noexcept { return sender_t{this}; }
+
+    bool ready() const noexcept {
+        return state_.load(std::memory_order_acquire) == set_state;
+    }
+
+    struct awaiter {
+        oneshot* o_;
+
+        bool await_ready() const noexcept { return o_->ready(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) noexcept {
+            std::uintptr_t expected = 0;
+            // fails only if the value arrived first
+            return o_->state_.compare_exchange_strong(expected, reinterpret_cast<std::uintptr_t>(coro.address()),
+                                                      std::memory_order_release, std::memory_order_acquire);
+        }
+
+        T await_resume() {
+            if (o_->value_.index() == 2) {
+                std::rethrow_exception(std::get<2>(o_->value_));
+            }
+            if constexpr (!std::is_void_v<T>) {
+                return std::move(std::get<1>(o_->value_));
+            }
+        }
+    };
+
+    awaiter operator co_await () noexcept { return awaiter{this}; }
+
+private:
+    void complete() {
+        auto old = state_.exchange(set_state, std::memory_order_acq_rel);
+        assert(old != set_state && "oneshot completed twice");
+        if (old != 0 && old != set_state) {
+            std::experimental::coroutine_handle<>::from_address(reinterpret_cast<void*>(old)).resume();
+        }
+    }
+
+    static constexpr std::uintptr_t set_state = 1;
+    // otherwise: 0 for nothing yet, or the address of the waiting coroutine's frame
+
+    std::atomic<std::uintptr_t> state_{0};
+    std::variant<std::monostate, typename detail::oneshot_value<T>::type, std::exception_ptr> value_;
+};
+
+#endif // ASYNC_EVENT_HPP
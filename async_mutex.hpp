@@ -0,0 +1,405 @@
+// Mutual exclusion and counting semaphores for coroutines, without blocking threads
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ASYNC_MUTEX_HPP
+#define ASYNC_MUTEX_HPP
+
+// co_await m.lock() and co_await s.acquire() suspend the coroutine, not the
+// thread, until the mutex or a permit is available. Waiters are kept in their
+// awaiters (in the coroutine frames), so a suspended waiter costs no more
+// than its frame; taking an uncontended lock or permit is a single
+// compare-and-swap.
+//
+// Whoever releases hands the mutex or permit straight to the next waiter
+// and resumes it. By default that happens right there, inside unlock() or
+// release(), on the releasing thread. To have the waiter resumed somewhere
+// else, e.g. on its own run_queue or Asio executor, give lock()/acquire() a
+// scheduler: a callable that is passed the waiter's coroutine_handle<> and
+// arranges for it to be resumed, like
+//
+//    co_await m.lock([&q](auto h) { q.add_task([h](run_queue*) { h.resume(); }); });
+//
+// which also keeps the stack flat: resuming inline nests each waiter inside
+// the unlock() of the one before it, for as long as they keep handing over.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <utility>
+#include <experimental/coroutine>
+
+namespace detail {
+
+// the part of an awaiter that is queued: who to resume, and how
+struct sync_waiter {
+    sync_waiter* next_ = nullptr;
+    std::experimental::coroutine_handle<> coro_;
+    void (*resume_)(sync_waiter*) = &resume_inline;
+    bool queued_ = false;       // for queues under a mutex: whether it is in one
+
+    static void resume_inline(sync_waiter* w) {
+        w->coro_.resume();
+    }
+};
+
+// A scheduler stored alongside the waiter; does nothing for the default
+struct resume_inline_t {};
+
+template<typename Schedule>
+struct scheduled_waiter : sync_waiter {
+    explicit scheduled_waiter(Schedule s) : schedule_(std::move(s)) {
+        resume_ = &resume_scheduled;
+    }
+
+private:
+    static void resume_scheduled(sync_waiter* w) {
+        auto self = static_cast<scheduled_waiter*>(w);
+        self->schedule_(self->coro_);
+    }
+
+    Schedule schedule_;
+};
+
+template<>
+struct scheduled_waiter<resume_inline_t> : sync_waiter {
+    explicit scheduled_waiter(resume_inline_t) {}
+};
+
+}
+
+//
+// Mutex
+//
+
+// The state is one word (after Lewis Baker's cppcoro::async_mutex): unlocked,
+// locked, or locked with a stack of newly arrived waiters, which they push
+// themselves onto with compare-and-swap. unlock() takes that whole stack at
+// once and reverses it into a queue only the holder touches, so waiters get
+// the lock in order of arrival and there is no lock inside the mutex.
+// A coroutine must not be destroyed while waiting for the lock.
+
+struct async_mutex {
+    async_mutex() = default;
+    async_mutex(async_mutex const&) = delete;
+
+    bool try_lock() noexcept {
+        auto expected = not_locked;
+        return state_.compare_exchange_strong(expected, locked_no_waiters,
+                                              std::memory_order_acquire, std::memory_order_relaxed);
+    }
+
+    template<typename Schedule>
+    struct lock_awaiter : detail::scheduled_waiter<Schedule> {
+        async_mutex* mutex_;
+
+        lock_awaiter(async_mutex* m, Schedule s) : detail::scheduled_waiter<Schedule>(std::move(s)), mutex_(m) {}
+        lock_awaiter(lock_awaiter const&) = delete;
+
+        bool await_ready() noexcept { return mutex_->try_lock(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) noexcept {
+            this->coro_ = coro;
+            auto state = mutex_->state_.load(std::memory_order_relaxed);
+            while (true) {
+                if (state == not_locked) {
+                    // released while we were getting here
+                    if (mutex_->state_.compare_exchange_weak(state, locked_no_waiters,
+                                                             std::memory_order_acquire,
+                                                             std::memory_order_relaxed)) {
+                        return false;
+                    }
+                } else {
+                    this->next_ = reinterpret_cast<detail::sync_waiter*>(state);
+                    if (mutex_->state_.compare_exchange_weak(state, reinterpret_cast<std::uintptr_t>(this),
+                                                             std::memory_order_release,
+                                                             std::memory_order_relaxed)) {
+                        return true;
+                    }
+                }
+            }
+        }
+
+        void await_resume() const noexcept {}
+    };
+
+    // unlocks when it goes out of scope
+    struct scoped_lock {
+        explicit scoped_lock(async_mutex& m) noexcept : mutex_(&m) {}
+        scoped_lock(scoped_lock&& other) noexcept : mutex_(std::exchange(other.mutex_, nullptr)) {}
+        scoped_lock(scoped_lock const&) = delete;
+        ~scoped_lock() {
+            if (mutex_) {
+                mutex_->unlock();
+            }
+        }
+
+    private:
+        async_mutex* mutex_;
+    };
+
+    template<typename Schedule>
+    struct scoped_lock_awaiter : lock_awaiter<Schedule> {
+        using lock_awaiter<Schedule>::lock_awaiter;
+        scoped_lock await_resume() const noexcept { return scoped_lock(*this->mutex_); }
+    };
+
+    template<typename Schedule = detail::resume_inline_t>
+    lock_awaiter<Schedule> lock(Schedule s = {}) {
+        return lock_awaiter<Schedule>(this, std::move(s));
+    }
+
+    // auto guard = co_await m.scoped_lock_async();
+    template<typename Schedule = detail::resume_inline_t>
+    scoped_lock_awaiter<Schedule> scoped_lock_async(Schedule s = {}) {
+        return scoped_lock_awaiter<Schedule>(this, std::move(s));
+    }
+
+    // passes the lock to the longest waiter, if any, and resumes it
+    void unlock() {
+        auto* next = waiters_;
+        if (!next) {
+            auto expected = locked_no_waiters;
+            if (state_.compare_exchange_strong(expected, not_locked,
+                                               std::memory_order_release, std::memory_order_relaxed)) {
+                return;
+            }
+            // take everyone who has arrived since, and put them in arrival order
+            auto stack = state_.exchange(locked_no_waiters, std::memory_order_acquire);
+            auto* w = reinterpret_cast<detail::sync_waiter*>(stack);
+            while (w) {
+                auto* following = w->next_;
+                w->next_ = next;
+                next = w;
+                w = following;
+            }
+        }
+        waiters_ = next->next_;
+        next->resume_(next);
+    }
+
+private:
+    static constexpr std::uintptr_t not_locked = 1;
+    static constexpr std::uintptr_t locked_no_waiters = 0;
+    // anything else: locked, and the address of the most recently arrived waiter
+
+    std::atomic<std::uintptr_t> state_{not_locked};
+    detail::sync_waiter* waiters_ = nullptr;    // only touched by the holder
+};
+
+//
+// Semaphore
+//
+
+// Permits are an atomic count, taken with compare-and-swap. Coroutines that
+// find none queue up, in order, under a mutex that is only touched when
+// someone is waiting; release() then hands permits to them directly.
+
+struct async_semaphore {
+    explicit async_semaphore(std::ptrdiff_t permits) : permits_(permits) {}
+    async_semaphore(async_semaphore const&) = delete;
+
+    bool try_acquire() noexcept {
+        auto available = permits_.load(std::memory_order_relaxed);
+        while (available > 0) {
+            if (permits_.compare_exchange_weak(available, available - 1,
+                                               std::memory_order_acquire, std::memory_order_relaxed)) {
+                return true;
+            }
+        }
+        return false;
+    }
+
+    template<typename Schedule>
+    struct acquire_awaiter : detail::scheduled_waiter<Schedule> {
+        async_semaphore* sem_;
+
+        acquire_awaiter(async_semaphore* s, Schedule sched)
+            : detail::scheduled_waiter<Schedule>(std::move(sched)), sem_(s) {}
+        acquire_awaiter(acquire_awaiter const&) = delete;
+
+        // a coroutine destroyed while waiting leaves the queue
+        ~acquire_awaiter() {
+            cancel();
+        }
+
+        // the same, for an owner that must be out of the queue before it lets go
+        // of something the semaphore's lifetime depends on
+        void cancel() {
+            if (this->coro_) {
+                sem_->cancel(this);
+                this->coro_ = nullptr;
+            }
+        }
+
+        bool await_ready() noexcept { return sem_->try_acquire(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+            this->coro_ = coro;
+            return sem_->enqueue(this);
+        }
+
+        // By now we are out of the queue, so there is nothing for cancel() to
+        // do; forgetting the coroutine saves it taking the mutex to find that out
+        void await_resume() noexcept {
+            this->coro_ = nullptr;
+        }
+    };
+
+    // releases its permit when it goes out of scope
+    struct scoped_permit {
+        explicit scoped_permit(async_semaphore& s) noexcept : sem_(&s) {}
+        scoped_permit(scoped_permit&& other) noexcept : sem_(std::exchange(other.sem_, nullptr)) {}
+        scoped_permit(scoped_permit const&) = delete;
+        ~scoped_permit() {
+            if (sem_) {
+                sem_->release();
+            }
+        }
+
+    private:
+        async_semaphore* sem_;
+    };
+
+    template<typename Schedule>
+    struct scoped_acquire_awaiter : acquire_awaiter<Schedule> {
+        using acquire_awaiter<Schedule>::acquire_awaiter;
+        scoped_permit await_resume() noexcept {
+            acquire_awaiter<Schedule>::await_resume();
+            return scoped_permit(*this->sem_);
+        }
+    };
+
+    template<typename Schedule = detail::resume_inline_t>
+    acquire_awaiter<Schedule> acquire(Schedule s = {}) {
+        return acquire_awaiter<Schedule>(this, std::move(s));
+    }
+
+    // auto permit = co_await s.scoped_acquire();
+    template<typename Schedule = detail::resume_inline_t>
+    scoped_acquire_awaiter<Schedule> scoped_acquire(Schedule s = {}) {
+        return scoped_acquire_awaiter<Schedule>(this, std::move(s));
+    }
+
+    void release(std::ptrdiff_t n = 1) {
+        permits_.fetch_add(n, std::memory_order_release);
+        // pairs with the fence in enqueue(): either we see the waiter, or it sees the permit
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (waiting_.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        detail::sync_waiter* ready = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready = serve();
+        }
+        resume_all(ready);
+    }
+
+    // permits available now
+    std::ptrdiff_t available() const noexcept {
+        return permits_.load(std::memory_order_relaxed);
+    }
+
+private:
+    // returns true if the coroutine should stay suspended
+    bool enqueue(detail::sync_waiter* w) {
+        detail::sync_waiter* ready = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            w->next_ = nullptr;
+            (tail_ ? tail_->next_ : head_) = w;
+            tail_ = w;
+            w->queued_ = true;
+            waiting_.store(waiting_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            // pairs with the fence in release()
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ready = serve();
+        }
+        // permits were released while we were queueing: maybe for us, maybe
+        // also for some ahead of us, who are resumed before we continue
+        bool ours = false;
+        for (auto** p = &ready; *p; p = &(*p)->next_) {
+            if (*p == w) {
+                *p = w->next_;
+                ours = true;
+                break;
+            }
+        }
+        resume_all(ready);
+        return !ours;
+    }
+
+    void cancel(detail::sync_waiter* w) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (!w->queued_) {
+            return;
+        }
+        detail::sync_waiter* prev = nullptr;
+        for (auto* p = head_; p != w; prev = p, p = p->next_) {}
+        (prev ? prev->next_ : head_) = w->next_;
+        if (tail_ == w) {
+            tail_ = prev;
+        }
+        w->queued_ = false;
+        waiting_.store(waiting_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+    }
+
+    // Under the mutex: give available permits to waiters, in order. Returns
+    // those served, linked through next_, for resuming after the mutex is released
+    detail::sync_waiter* serve() noexcept {
+        detail::sync_waiter* ready = nullptr;
+        detail::sync_waiter** ready_tail = &ready;
+        while (head_ && try_acquire()) {
+            auto* w = head_;
+            head_ = w->next_;
+            if (!head_) {
+                tail_ = nullptr;
+            }
+            w->next_ = nullptr;
+            w->queued_ = false;
+            waiting_.store(waiting_.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+            *ready_tail = w;
+            ready_tail = &w->next_;
+        }
+        return ready;
+    }
+
+    static void resume_all(detail::sync_waiter* w) {
+        while (w) {
+            auto* next = w->next_;  // w is gone once its coroutine continues
+            w->resume_(w);
+            w = next;
+        }
+    }
+
+    std::atomic<std::ptrdiff_t> permits_;
+    std::atomic<std::size_t> waiting_{0};
+    std::mutex mutex_;
+    detail::sync_waiter* head_ = nullptr;
+    detail::sync_waiter* tail_ = nullptr;
+};
+
+#endif // ASYNC_MUTEX_HPP
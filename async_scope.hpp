@@ -0,0 +1,219 @@
+// Owning detached coroutines, with a cap on how many run at once
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef ASYNC_SCOPE_HPP
+#define ASYNC_SCOPE_HPP
+
+// Rather than holding a return object for every coroutine you start, write
+// them as scoped_task coroutines and hand them to an async_scope:
+//
+//    scoped_task handle(request r) { ... }
+//
+//    async_scope scope(100);                 // at most 100 in flight
+//    co_await scope.spawn(handle(r));        // waits while 100 are running
+//    scope.try_spawn(handle(r));             // or: false (and dropped) if 100 are running
+//    ...
+//    co_await scope.join();                  // all of them have finished
+//
+// A scoped_task does nothing until spawned. Once started it belongs to the
+// scope, and its frame is freed as soon as it finishes, so memory is bounded
+// by the cap no matter how many are spawned over time. The cap is an
+// async_semaphore and join() an async_event, so waiting spawners and the
+// joiner are suspended coroutines, not blocked threads.
+//
+// join() may be awaited once, after the last spawn; the scope must be joined
+// before it is destroyed. The first exception to escape a task is rethrown
+// from join().
+
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <limits>
+#include <utility>
+#include <experimental/coroutine>
+
+#include "async_event.hpp"
+#include "async_mutex.hpp"
+#include "coro_trace.hpp"
+#include "frame_stats.hpp"
+
+struct async_scope;
+
+struct scoped_task {
+    struct promise_type : coro_trace::promise_hooks<promise_type>, frame_stats::accounted<promise_type> {
+        async_scope* scope_ = nullptr;
+
+        // wait to be spawned
+        auto initial_suspend() const noexcept {
+            return std::experimental::suspend_always();
+        }
+
+        // free the frame as soon as we finish
+        std::experimental::suspend_never final_suspend() noexcept;
+
+        void return_void() const noexcept {}
+
+        void unhandled_exception() noexcept;
+
+        scoped_task get_return_object() {
+            this->trace_create(*this);
+            return scoped_task(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    scoped_task(scoped_task const&) = delete;
+    scoped_task(scoped_task&& other) noexcept : coro_(std::exchange(other.coro_, nullptr)) {}
+
+    // a task never spawned is simply destroyed
+    ~scoped_task() {
+        if (coro_) {
+            coro_.destroy();
+        }
+    }
+
+private:
+    friend struct async_scope;
+
+    explicit scoped_task(std::experimental::coroutine_handle<promise_type> coro) : coro_(coro) {}
+
+    // hand the task over to the scope and run it until it first suspends
+    void start(async_scope* scope) {
+        auto coro = std::exchange(coro_, nullptr);
+        coro.promise().scope_ = scope;
+        coro.resume();
+    }
+
+    std::experimental::coroutine_handle<promise_type> coro_;
+};
+
+struct async_scope {
+    explicit async_scope(std::size_t max_in_flight = std::numeric_limits<std::ptrdiff_t>::max())
+        : slots_(static_cast<std::ptrdiff_t>(max_in_flight)) {}
+    async_scope(async_scope const&) = delete;
+
+    // co_await this to wait for room and start the task
+    struct spawn_awaiter {
+        async_semaphore::acquire_awaiter<detail::resume_inline_t> slot_;
+        async_scope* scope_;
+        scoped_task task_;
+
+        // if the spawning coroutine is destroyed while waiting
+        ~spawn_awaiter() {
+            if (task_.coro_) {
+                // finished() may let join() return and the scope, with slots_, go
+                // away, so leave slots_' queue first rather than in slot_'s destructor
+                slot_.cancel();
+                scope_->finished();
+            }
+        }
+
+        bool await_ready() noexcept { return slot_.await_ready(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+            return slot_.await_suspend(coro);
+        }
+
+        void await_resume() {
+            task_.start(scope_);
+        }
+    };
+
+    spawn_awaiter spawn(scoped_task task) {
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        return spawn_awaiter{slots_.acquire(), this, std::move(task)};
+    }
+
+    // start the task if there is room; otherwise drop it and return false
+    bool try_spawn(scoped_task task) {
+        if (!slots_.try_acquire()) {
+            return false;
+        }
+        outstanding_.fetch_add(1, std::memory_order_relaxed);
+        task.start(this);
+        return true;
+    }
+
+    struct join_awaiter {
+        async_scope* scope_;
+        async_event::awaiter done_;
+
+        bool await_ready() noexcept { return done_.await_ready(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) noexcept {
+            return done_.await_suspend(coro);
+        }
+
+        void await_resume() const {
+            if (scope_->error_) {
+                std::rethrow_exception(scope_->error_);
+            }
+        }
+    };
+
+    join_awaiter join() {
+        finished();     // drop the reference that kept the count above zero until now
+        return join_awaiter{this, done_.operator co_await()};
+    }
+
+private:
+    friend struct scoped_task::promise_type;
+
+    // a task is done (or was never started); the last one out wakes the joiner
+    void finished() {
+        if (outstanding_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            done_.set();
+        }
+    }
+
+    void task_finished() {
+        slots_.release();
+        finished();
+    }
+
+    void task_failed(std::exception_ptr e) {
+        bool expected = false;
+        if (failed_.compare_exchange_strong(expected, true, std::memory_order_relaxed)) {
+            error_ = std::move(e);  // published to join() through finished()
+        }
+    }
+
+    async_semaphore slots_;
+    std::atomic<std::size_t> outstanding_{1};   // tasks, plus one until join()
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;
+    async_event done_;
+};
+
+inline std::experimental::suspend_never scoped_task::promise_type::final_suspend() noexcept {
+    trace_final();
+    scope_->task_finished();
+    return {};
+}
+
+inline void scoped_task::promise_type::unhandled_exception() noexcept {
+    scope_->task_failed(std::current_exception());
+}
+
+#endif // ASYNC_SCOPE_HPP
@@ -0,0 +1,126 @@
+// Helpers for the micro-benchmarks: timing, allocation counting, and output
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef BENCH_HPP
+#define BENCH_HPP
+
+#include <chrono>
+#include <cstddef>
+#include <cstdlib>
+#include <iostream>
+#include <ostream>
+#include <string>
+
+namespace bench {
+
+//
+// Allocation counting
+// The counters are maintained by the replacement global operator new/delete
+// in alloc_counter.cpp, which must be linked into any executable using this header.
+// Coroutine frames come from operator new unless the promise supplies its own,
+// so the number of bytes allocated when a coroutine is created is its frame size.
+//
+
+struct alloc_stats {
+    std::size_t count;
+    std::size_t bytes;
+};
+
+alloc_stats allocations() noexcept;
+
+//
+// One measurement
+//
+
+struct result {
+    std::string name;
+    std::size_t iterations;
+    double      ns_per_op;
+    double      allocs_per_op;
+    double      bytes_per_op;
+};
+
+// run "body" once with a small count to warm up caches and any recycling
+// allocators, then again with the real count. The body runs the loop itself
+// so the timing doesn't include a call through a type-erased function per op.
+template<typename Body>
+result measure(std::string name, std::size_t iterations, Body body) {
+    body(iterations / 10 + 1);
+
+    auto a0 = allocations();
+    auto t0 = std::chrono::steady_clock::now();
+    body(iterations);
+    auto t1 = std::chrono::steady_clock::now();
+    auto a1 = allocations();
+
+    double n = static_cast<double>(iterations);
+    return result{std::move(name), iterations,
+                  std::chrono::duration<double, std::nano>(t1 - t0).count() / n,
+                  static_cast<double>(a1.count - a0.count) / n,
+                  static_cast<double>(a1.bytes - a0.bytes) / n};
+}
+
+// the compiler identification string, so results from different toolchains can be told apart
+inline char const* compiler() {
+#if defined(__clang__)
+    return "clang " __clang_version__;
+#elif defined(__GNUC__)
+    return "gcc " __VERSION__;
+#elif defined(_MSC_VER)
+#define BENCH_STR2(x) #x
+#define BENCH_STR(x) BENCH_STR2(x)
+    return "msvc " BENCH_STR(_MSC_FULL_VER);
+#else
+    return "unknown";
+#endif
+}
+
+// One JSON object per line, so results can be appended to a file and compared across runs
+inline void report(std::ostream& os, result const& r) {
+    os << "{\"benchmark\":\"" << r.name << "\""
+       << ",\"iterations\":" << r.iterations
+       << ",\"ns_per_op\":" << r.ns_per_op
+       << ",\"ops_per_sec\":" << (r.ns_per_op > 0 ? 1e9 / r.ns_per_op : 0.0)
+       << ",\"allocs_per_op\":" << r.allocs_per_op
+       << ",\"bytes_per_op\":" << r.bytes_per_op
+       << ",\"compiler\":\"" << compiler() << "\"}\n";
+}
+
+// iteration count from the command line, if supplied; anything that isn't
+// a positive number is an error, as measure() divides by the count
+inline std::size_t iterations(int argc, char** argv, std::size_t dflt) {
+    if (argc > 1) {
+        char* end = nullptr;
+        auto n = std::strtoull(argv[1], &end, 10);
+        if (end == argv[1] || *end != '\0' || n == 0) {
+            std::cerr << "iteration count must be a positive number, not \"" << argv[1] << "\"\n";
+            std::exit(1);
+        }
+        return n;
+    }
+    return dflt;
+}
+
+}
+
+#endif // BENCH_HPP
@@ -0,0 +1,139 @@
+// Awaiting any callback-style API, without allocating
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CALLBACK_AWAITABLE_HPP
+#define CALLBACK_AWAITABLE_HPP
+
+// For APIs in the style of multiply(a, b, cb) from callbacks.cpp:
+//
+//   int product = co_await make_callback_awaitable<int>(api, a, b);
+//
+// calls api(a, b, cb) and gives back what cb was called with: nothing, one
+// value, or a std::tuple for several, according to the Results listed.
+// For a function template like multiply, pass a generic lambda:
+//
+//   co_await make_callback_awaitable<int>([](int a, int b, auto cb) { multiply(a, b, cb); }, 2, 3);
+//
+// The callback passed to the API is one pointer, so any type erasure the API
+// does internally (a std::function, say) stays within its small buffer, and
+// the result is stored in the awaiter, which lives in the coroutine frame:
+// nothing is allocated per call.
+// If the API calls back before returning, the coroutine just carries on from
+// await_suspend rather than being resumed from inside the callback, so a loop
+// of synchronous completions doesn't grow the stack. The callback may also
+// come from another thread.
+// The callback must be called exactly once.
+
+#include <atomic>
+#include <functional>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <experimental/coroutine>
+
+namespace detail {
+
+// where the callback's arguments are kept until await_resume
+template<typename... Results>
+struct callback_result {
+    template<typename... Args>
+    void set(Args&&... args) { value_.emplace(std::forward<Args>(args)...); }
+
+    std::tuple<Results...> get() { return std::move(*value_); }
+
+private:
+    std::optional<std::tuple<Results...>> value_;
+};
+
+template<typename Result>
+struct callback_result<Result> {
+    template<typename Arg>
+    void set(Arg&& arg) { value_.emplace(std::forward<Arg>(arg)); }
+
+    Result get() { return std::move(*value_); }
+
+private:
+    std::optional<Result> value_;
+};
+
+template<>
+struct callback_result<> {
+    void set() noexcept {}
+
+    void get() noexcept {}
+};
+
+}
+
+template<typename F, typename ArgTuple, typename... Results>
+struct callback_awaitable;
+
+template<typename F, typename... Args, typename... Results>
+struct callback_awaitable<F, std::tuple<Args...>, Results...> {
+    callback_awaitable(F f, Args... args) : f_(std::move(f)), args_(std::move(args)...) {}
+
+    // what the API gets to call
+    struct callback {
+        template<typename... Values>
+        void operator()(Values&&... values) const {
+            self_->result_.set(std::forward<Values>(values)...);
+            // whoever gets here second resumes: if await_suspend is still
+            // running it will see we're done and not suspend
+            if (self_->done_.exchange(true, std::memory_order_acq_rel)) {
+                self_->coro_.resume();
+            }
+        }
+
+        callback_awaitable* self_;
+    };
+
+    bool await_ready() const noexcept { return false; }
+
+    template<typename P>
+    bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+        coro_ = coro;
+        std::apply([this](Args&... args) { std::invoke(f_, std::move(args)..., callback{this}); }, args_);
+        // false (don't suspend) if the callback already ran
+        return !done_.exchange(true, std::memory_order_acq_rel);
+    }
+
+    auto await_resume() { return result_.get(); }
+
+private:
+    F f_;
+    std::tuple<Args...> args_;
+    detail::callback_result<Results...> result_;
+    std::atomic<bool> done_{false};
+    std::experimental::coroutine_handle<> coro_;
+};
+
+// type deduction helper; the Results can't be deduced, as the API is free to
+// call the callback with anything, so they are given explicitly
+template<typename... Results, typename F, typename... Args>
+callback_awaitable<F, std::tuple<Args...>, Results...>
+make_callback_awaitable(F f, Args... args) {
+    return callback_awaitable<F, std::tuple<Args...>, Results...>{std::move(f), std::move(args)...};
+}
+
+#endif // CALLBACK_AWAITABLE_HPP
@@ -26,6 +26,7 @@ SOFTWARE.
 // This is the coroutine equivalent of my multiply callback code in callbacks.cpp
 
 #include <iostream>
+#include "callback_awaitable.hpp"
 #include "my_awaitable.hpp"
 #include "co_awaiter.hpp"
 
@@ -39,7 +40,25 @@ await_return_object<> muladd() {
     std::cout << "result: " << result << "\n";
 }
 
+// or keep the callback version of multiply from callbacks.cpp and adapt it
+template<typename Callback>
+void multiply(int a, int b, Callback cb) {
+    int result = a * b;
+    cb(result);
+}
+
+await_return_object<> muladd_adapted() {
+    int a = 2;
+    int b = 3;
+    int c = 4;
+    int product = co_await make_callback_awaitable<int>(
+        [](int x, int y, auto cb) { multiply(x, y, cb); }, a, b);
+    int result = product + c;
+    std::cout << "result: " << result << "\n";
+}
+
 int main() {
     auto coro = muladd();
+    auto adapted = muladd_adapted();
 }
 
@@ -0,0 +1,418 @@
+// A bounded multi-producer, multi-consumer channel between coroutines
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CHANNEL_HPP
+#define CHANNEL_HPP
+
+// co_await ch.send(v) suspends while the channel is full, and
+// co_await ch.receive() while it is empty, so a chain of coroutines joined by
+// channels runs at the pace of its slowest stage with bounded memory in between.
+//
+// The buffer is a ring with a sequence number per slot (after Dmitry Vyukov's
+// bounded MPMC queue, like shm_ring.hpp), so while there is room and there are
+// messages, senders and receivers take no locks. A coroutine that has to wait
+// links its awaiter (which lives in its frame) into a list, under a mutex; the
+// other side checks for waiters after each operation, finishes the waiting
+// operation on its behalf, and resumes it. So nothing is allocated per message
+// or per wait, and a waiting coroutine resumes on the thread of the
+// coroutine that unblocked it.
+//
+// send_n() sends a range, waiting as needed until all of it is sent;
+// receive_n() waits for at least one message and then takes as many as are
+// there, up to a limit.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <experimental/coroutine>
+
+template<typename T, std::size_t Capacity>
+struct channel {
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+
+    channel() {
+        for (std::size_t i = 0; i < Capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    channel(channel const&) = delete;
+
+    ~channel() {
+        while (pop([](T&&) {})) {}
+    }
+
+    //
+    // Without waiting
+    //
+
+    template<typename U>
+    bool try_send(U&& v) {
+        if (!push(std::forward<U>(v))) {
+            return false;
+        }
+        wake_waiters();
+        return true;
+    }
+
+    std::optional<T> try_receive() {
+        std::optional<T> result;
+        if (pop([&result](T&& v) { result.emplace(std::move(v)); })) {
+            wake_waiters();
+        }
+        return result;
+    }
+
+private:
+    //
+    // Waiting
+    //
+
+    // The part of every awaiter that goes in the lists. step() tries to make
+    // progress on the operation and says how it went.
+    enum class progress { none, some, done };
+
+    struct waiter;
+
+    struct waiter_list {
+        waiter* head = nullptr;
+        waiter* tail = nullptr;
+        std::atomic<std::size_t> size{0};   // written under the mutex, read without it
+
+        void push_back(waiter* w) noexcept {
+            w->prev_ = tail;
+            w->next_ = nullptr;
+            (tail ? tail->next_ : head) = w;
+            tail = w;
+            w->linked_ = true;
+            size.store(size.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+        }
+
+        void remove(waiter* w) noexcept {
+            (w->prev_ ? w->prev_->next_ : head) = w->next_;
+            (w->next_ ? w->next_->prev_ : tail) = w->prev_;
+            w->linked_ = false;
+            size.store(size.load(std::memory_order_relaxed) - 1, std::memory_order_relaxed);
+        }
+    };
+
+    struct waiter {
+        channel* ch_;
+        waiter_list* list_;     // which of the channel's lists this would wait in
+        progress (*step_)(waiter*);
+        std::experimental::coroutine_handle<> coro_;
+        waiter* prev_ = nullptr;
+        waiter* next_ = nullptr;
+        bool linked_ = false;   // under the mutex
+        bool parked_ = false;   // in a list, or about to be; cleared before resuming
+
+        waiter(channel* ch, waiter_list* list, progress (*step)(waiter*))
+            : ch_(ch), list_(list), step_(step) {}
+        waiter(waiter const&) = delete;
+
+        // a coroutine destroyed while waiting takes itself out of the list;
+        // once woken (the usual case) there's nothing to do and no lock to take
+        ~waiter() {
+            if (parked_) {
+                ch_->cancel(this);
+            }
+        }
+
+        bool await_ready() {
+            auto p = step_(this);
+            if (p != progress::none) {
+                ch_->wake_waiters();
+            }
+            return p == progress::done;
+        }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+            coro_ = coro;
+            parked_ = true;
+            return ch_->park(this);
+        }
+    };
+
+public:
+    template<typename U>
+    struct send_awaiter : waiter {
+        U value_;
+
+        template<typename V>
+        send_awaiter(channel* ch, V&& v) : waiter(ch, &ch->senders_, &step), value_(std::forward<V>(v)) {}
+
+        void await_resume() const noexcept {}
+
+    private:
+        static progress step(waiter* w) {
+            auto self = static_cast<send_awaiter*>(w);
+            return self->ch_->push(std::move(self->value_)) ? progress::done : progress::none;
+        }
+    };
+
+    template<typename It>
+    struct send_n_awaiter : waiter {
+        It next_value_;
+        std::size_t remaining_;
+
+        send_n_awaiter(channel* ch, It first, std::size_t n)
+            : waiter(ch, &ch->senders_, &step), next_value_(first), remaining_(n) {}
+
+        void await_resume() const noexcept {}
+
+    private:
+        static progress step(waiter* w) {
+            auto self = static_cast<send_n_awaiter*>(w);
+            bool moved = false;
+            while (self->remaining_ != 0 && self->ch_->push(*self->next_value_)) {
+                ++self->next_value_;
+                --self->remaining_;
+                moved = true;
+            }
+            return self->remaining_ == 0 ? progress::done : moved ? progress::some : progress::none;
+        }
+    };
+
+    struct receive_awaiter : waiter {
+        std::optional<T> value_;
+
+        explicit receive_awaiter(channel* ch) : waiter(ch, &ch->receivers_, &step) {}
+
+        T await_resume() { return std::move(*value_); }
+
+    private:
+        static progress step(waiter* w) {
+            auto self = static_cast<receive_awaiter*>(w);
+            return self->ch_->pop([self](T&& v) { self->value_.emplace(std::move(v)); })
+                ? progress::done : progress::none;
+        }
+    };
+
+    template<typename OutIt>
+    struct receive_n_awaiter : waiter {
+        OutIt out_;
+        std::size_t limit_;
+        std::size_t count_ = 0;
+
+        receive_n_awaiter(channel* ch, OutIt out, std::size_t n)
+            : waiter(ch, &ch->receivers_, &step), out_(out), limit_(n) {}
+
+        // how many were received
+        std::size_t await_resume() const noexcept { return count_; }
+
+    private:
+        static progress step(waiter* w) {
+            auto self = static_cast<receive_n_awaiter*>(w);
+            while (self->count_ < self->limit_ &&
+                   self->ch_->pop([self](T&& v) { *self->out_++ = std::move(v); })) {
+                ++self->count_;
+            }
+            return self->count_ != 0 || self->limit_ == 0 ? progress::done : progress::none;
+        }
+    };
+
+    template<typename U>
+    send_awaiter<std::decay_t<U>> send(U&& v) {
+        return send_awaiter<std::decay_t<U>>(this, std::forward<U>(v));
+    }
+
+    // sends n values starting at first (use a move_iterator to move them)
+    template<typename It>
+    send_n_awaiter<It> send_n(It first, std::size_t n) {
+        return send_n_awaiter<It>(this, first, n);
+    }
+
+    receive_awaiter receive() {
+        return receive_awaiter(this);
+    }
+
+    // receives between 1 and n values into out; the result is the number received
+    template<typename OutIt>
+    receive_n_awaiter<OutIt> receive_n(OutIt out, std::size_t n) {
+        return receive_n_awaiter<OutIt>(this, out, n);
+    }
+
+private:
+    //
+    // The ring
+    //
+
+    template<typename U>
+    bool push(U&& v) {
+        auto pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& s = slots_[pos & mask];
+            auto seq = s.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::int64_t>(seq - pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    ::new (static_cast<void*>(&s.storage)) T(std::forward<U>(v));
+                    s.seq.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;       // full
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // hands the value at the head to sink, if there is one
+    template<typename Sink>
+    bool pop(Sink&& sink) {
+        auto pos = head_.load(std::memory_order_relaxed);
+        while (true) {
+            auto& s = slots_[pos & mask];
+            auto seq = s.seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::int64_t>(seq - (pos + 1));
+            if (diff == 0) {
+                if (head_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    T* value = std::launder(reinterpret_cast<T*>(&s.storage));
+                    sink(std::move(*value));
+                    value->~T();
+                    s.seq.store(pos + Capacity, std::memory_order_release);
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;       // empty
+            } else {
+                pos = head_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    //
+    // Waiters
+    //
+
+    // After a send or receive: if anyone is waiting, see whether they can
+    // proceed now. The fence pairs with the one in park(): either we see the
+    // waiter, or it sees what we just did.
+    void wake_waiters() {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (receivers_.size.load(std::memory_order_relaxed) == 0 &&
+            senders_.size.load(std::memory_order_relaxed) == 0) {
+            return;
+        }
+        waiter* ready = nullptr;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            ready = settle();
+        }
+        resume_all(ready);
+    }
+
+    // returns true if the coroutine should stay suspended
+    bool park(waiter* w) {
+        waiter* ready = nullptr;
+        bool done;
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            w->list_->push_back(w);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            ready = settle();
+            done = !w->linked_;
+        }
+        // the others that became ready run now; we continue without suspending
+        if (done) {
+            w->parked_ = false;
+            waiter** p = &ready;
+            while (*p != w) {
+                p = &(*p)->next_;
+            }
+            *p = w->next_;
+        }
+        resume_all(ready);
+        return !done;
+    }
+
+    void cancel(waiter* w) {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (w->linked_) {
+            w->list_->remove(w);
+        }
+    }
+
+    // Under the mutex: let the waiters at the front of each list proceed for
+    // as long as any of them can. Those that finish are unlinked and returned
+    // in a list (through next_) for resuming once the mutex is released.
+    waiter* settle() {
+        waiter* ready = nullptr;
+        waiter** ready_tail = &ready;
+        bool progressed = true;
+        while (progressed) {
+            progressed = false;
+            for (waiter_list* list : {&receivers_, &senders_}) {
+                while (waiter* w = list->head) {
+                    auto p = w->step_(w);
+                    if (p == progress::none) {
+                        break;
+                    }
+                    progressed = true;
+                    if (p == progress::some) {
+                        break;      // the channel is full again
+                    }
+                    list->remove(w);
+                    w->parked_ = false;     // seen by its coroutine once resumed
+                    w->next_ = nullptr;
+                    *ready_tail = w;
+                    ready_tail = &w->next_;
+                }
+            }
+        }
+        return ready;
+    }
+
+    static void resume_all(waiter* w) {
+        while (w) {
+            auto next = w->next_;   // w is gone once its coroutine continues
+            w->coro_.resume();
+            w = next;
+        }
+    }
+
+    static constexpr std::uint64_t mask = Capacity - 1;
+
+    struct slot {
+        std::atomic<std::uint64_t> seq;
+        std::aligned_storage_t<sizeof(T), alignof(T)> storage;
+    };
+
+    // keep the producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<std::uint64_t> tail_{0};
+    alignas(64) std::atomic<std::uint64_t> head_{0};
+    alignas(64) slot slots_[Capacity];
+
+    std::mutex mutex_;
+    waiter_list senders_;
+    waiter_list receivers_;
+};
+
+#endif // CHANNEL_HPP
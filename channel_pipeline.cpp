@@ -0,0 +1,178 @@
+// A three-stage pipeline of coroutines started on three threads, joined by bounded channels
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// source -> square -> sum, each stage a coroutine started on its own thread.
+// A stage that finds its input empty or its output full suspends, and is
+// resumed inline by the stage that unblocks it, on whatever thread that one
+// is running on. So stages don't keep to their threads: they migrate, often
+// ending up running one after another on a single thread, and a thread whose
+// stage has suspended just waits at the finish line.
+// The channels are small, so the stages are held to each other's pace.
+// Output is in the format of coro_bench.cpp; there should be no allocations
+// per message.
+//
+// usage: chp [messages]
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <exception>
+#include <iostream>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <experimental/coroutine>
+
+#include "bench.hpp"
+#include "channel.hpp"
+#include "frame_stats.hpp"
+
+using numbers = channel<std::uint64_t, 256>;
+
+// counts finished stages
+struct finish_line {
+    void arrive() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        ++count_;
+        cv_.notify_all();
+    }
+
+    void wait_for(int n) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [&] { return count_ >= n; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    int count_ = 0;
+};
+
+// A stage coroutine. It reaches the finish line from its final suspend,
+// not from its body: the rest of the body may still be running on another
+// thread after the last line of it, and the owning thread destroys the
+// frame as soon as all the stages have arrived.
+struct stage {
+    struct promise_type : frame_stats::accounted<promise_type> {
+        finish_line* done_ = nullptr;
+
+        auto initial_suspend() const noexcept { return std::experimental::suspend_always(); }
+
+        struct arrive {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::experimental::coroutine_handle<promise_type> coro) const noexcept {
+                coro.promise().done_->arrive();
+            }
+            void await_resume() const noexcept {}
+        };
+        arrive final_suspend() const noexcept { return {}; }
+
+        void return_void() const noexcept {}
+        void unhandled_exception() { std::terminate(); }
+
+        stage get_return_object() {
+            return stage(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    stage(stage&& other) noexcept : coro_(std::exchange(other.coro_, nullptr)) {}
+    stage(stage const&) = delete;
+    ~stage() {
+        if (coro_) {
+            coro_.destroy();
+        }
+    }
+
+    void start(finish_line& done) {
+        coro_.promise().done_ = &done;
+        coro_.resume();
+    }
+
+private:
+    explicit stage(std::experimental::coroutine_handle<promise_type> coro) : coro_(coro) {}
+
+    std::experimental::coroutine_handle<promise_type> coro_;
+};
+
+stage source(numbers& out, std::size_t n) {
+    for (std::uint64_t i = 0; i < n; ++i) {
+        co_await out.send(i);
+    }
+}
+
+stage square(numbers& in, numbers& out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto v = co_await in.receive();
+        co_await out.send(v * v);
+    }
+}
+
+// takes whatever has arrived, up to a batch at a time
+stage sum(numbers& in, std::size_t n, std::uint64_t& total) {
+    std::uint64_t batch[64];
+    std::size_t received = 0;
+    while (received < n) {
+        auto count = co_await in.receive_n(batch, std::min<std::size_t>(64, n - received));
+        for (std::size_t i = 0; i < count; ++i) {
+            total += batch[i];
+        }
+        received += count;
+    }
+}
+
+// start a stage on a thread of its own, which then keeps its coroutine alive until the end
+template<typename Make>
+std::thread start(Make make, finish_line& done) {
+    return std::thread([make, &done]() {
+        auto coro = make();
+        coro.start(done);
+        done.wait_for(3);
+    });
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 1000000);
+    std::uint64_t total = 0;
+    std::uint64_t expected = 0;
+
+    bench::report(std::cout, bench::measure("channel/pipeline_3_threads", n, [&](std::size_t k) {
+                numbers a, b;
+                finish_line done;
+                total = 0;
+                auto t3 = start([&]() { return sum(b, k, total); }, done);
+                auto t2 = start([&]() { return square(a, b, k); }, done);
+                auto t1 = start([&]() { return source(a, k); }, done);
+                t1.join();
+                t2.join();
+                t3.join();
+                expected = 0;
+                for (std::uint64_t i = 0; i < k; ++i) {
+                    expected += i * i;
+                }
+            }));
+
+    if (total != expected) {
+        std::cerr << "wrong total " << total << ", expected " << expected << "\n";
+        return 1;
+    }
+}
@@ -27,6 +27,9 @@ SOFTWARE.
 #include <type_traits>
 #include <experimental/coroutine>
 
+#include "coro_trace.hpp"
+#include "frame_stats.hpp"
+
 template<typename T=void>
 struct await_return_object {
     struct promise_type;
@@ -62,7 +65,8 @@ struct await_return_object {
     };
 #endif // INTERNAL_VOID_SPECIALIZATION
 
-    struct promise_type : promise_base<T> {
+    struct promise_type : promise_base<T>, coro_trace::promise_hooks<promise_type>,
+                          frame_stats::accounted<promise_type> {
         // coroutine promise requirements:
 
         auto initial_suspend() const noexcept {
@@ -85,12 +89,14 @@ struct await_return_object {
             // destroyed, suspend before destroying the coroutine itself. We are
             // letting the await_return_object destructor do that, via the handle's
             // destroy() method
+            this->trace_final();
             return std::experimental::suspend_always();
         }
 
         // either return_void or return_value will exist, depending on T
 
         await_return_object get_return_object() {
+            this->trace_create(*this);
             return await_return_object(*this);
         }
 
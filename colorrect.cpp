@@ -22,12 +22,14 @@ SOFTWARE.
 */
 
 #include <QMouseEvent>
+#include <QPaintEvent>
 #include <QPainter>
 
 #include "colorrect.h"
 
 ColorRect::ColorRect(QWidget *parent) :
     QWidget{parent},
+    // color names are parsed once, here, rather than on every change
     colorList{{"#111111", "#113311",
                 "#111133", "#331111",
                 "#333311", "#331133",
@@ -35,13 +37,11 @@ ColorRect::ColorRect(QWidget *parent) :
                 "#111166", "#663311",
                 "#661133", "#336611",
                 "#331166", "#113366"}},
-    curColor{0}
-{}
-
-void
-ColorRect::setColor(std::string const& col)
+    curColor{0},
+    linePen{QColor{Qt::yellow}}
 {
-    setStyleSheet(("background-color:" + col).c_str());
+    // we paint every pixel ourselves, so Qt needn't erase first
+    setAttribute(Qt::WA_OpaquePaintEvent);
 }
 
 void
@@ -52,7 +52,8 @@ ColorRect::changeColor()
     {
         curColor = 0;
     }
-    setColor(colorList[curColor]);
+    // the background changes everywhere, so this one is a full repaint
+    update();
 }
 
 void
@@ -62,18 +63,47 @@ ColorRect::mousePressEvent(QMouseEvent *e)
 }
 
 void
-ColorRect::paintEvent(QPaintEvent *)
+ColorRect::paintEvent(QPaintEvent *e)
 {
-    if (line) {
-        QPainter painter(this);
-        painter.setPen(QPen{QColor{"yellow"}});
-        painter.drawLine(*line);
+    // Qt clips the painter to the dirty region, so lines outside it cost little
+    QPainter painter(this);
+    painter.fillRect(e->rect(), colorList[curColor]);
+    if (!lines.empty()) {
+        painter.setPen(linePen);
+        painter.drawLines(lines.data(), static_cast<int>(lines.size()));
     }
 }
 
 void
 ColorRect::setLine(QPointF p1, QPointF p2)
 {
-    line = QLineF{p1, p2};
+    // the old lines have to be erased wherever they were
+    lines.clear();
+    update();
+    addLine(p1, p2);
+}
+
+void
+ColorRect::addLine(QPointF p1, QPointF p2)
+{
+    lines.emplace_back(p1, p2);
+    updateLine(lines.back());
     emit lineCreated(p1, p2);
 }
+
+void
+ColorRect::clearLines()
+{
+    lines.clear();
+    update();
+}
+
+// repaint just the area a line covers, plus a margin for the pen and antialiasing
+void
+ColorRect::updateLine(QLineF const& l)
+{
+    qreal margin = linePen.widthF() + 1;
+    update(QRectF{l.p1(), l.p2()}.normalized()
+           .adjusted(-margin, -margin, margin, margin)
+           .toAlignedRect());
+}
@@ -24,10 +24,11 @@ SOFTWARE.
 #ifndef COLORRECT_H
 #define COLORRECT_H
 
-#include <optional>
-#include <string>
-#include <QWidget>
+#include <vector>
+#include <QColor>
 #include <QLine>
+#include <QPen>
+#include <QWidget>
 
 class ColorRect : public QWidget
 {
@@ -38,7 +39,11 @@ public:
 
 public slots:
     void changeColor();
+    // replace all lines with this one
     void setLine(QPointF, QPointF);
+    // add to the lines already drawn
+    void addLine(QPointF, QPointF);
+    void clearLines();
 
 signals:
     void click(QPointF);
@@ -49,10 +54,12 @@ protected:
     void paintEvent(QPaintEvent *event) override;
 
 private:
-    void setColor(std::string const&);
-    std::vector<std::string> colorList;
+    void updateLine(QLineF const&);
+    std::vector<QColor>      colorList;
     std::size_t              curColor;
-    std::optional<QLineF>    line;
+    QPen                     linePen;
+    // everything drawn so far, painted in one batch
+    std::vector<QLineF>      lines;
 };
 
 #endif // COLORRECT_H
@@ -0,0 +1,375 @@
+// Micro-benchmarks comparing callbacks, awaitables, and generators
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The same a*b+c computation (and some of the machinery around it) done in each
+// of the styles in this repo, measured for time, allocations, and frame size.
+// Output is one JSON object per line; the Asio variants are in asio_bench.cpp.
+//
+// usage: bench [iterations]
+
+#include <future>
+#include <iostream>
+#include <vector>
+#include <experimental/coroutine>
+
+#include "async_event.hpp"
+#include "async_mutex.hpp"
+#include "async_scope.hpp"
+#include "bench.hpp"
+#include "callback_awaitable.hpp"
+#include "co_awaiter.hpp"
+#include "my_awaitable.hpp"
+#include "run_queue.hpp"
+
+namespace detail {
+// somewhere to put results so the optimizer can't discard the work
+static volatile int sink = 0;
+}
+
+// the callback-style multiply from callbacks.cpp
+template<typename Callback>
+void multiply(int a, int b, Callback cb) {
+    int result = a * b;
+    cb(result);
+}
+
+//
+// callbacks on run_queue (callbacks.cpp): one task per computation
+//
+
+void callback_muladd(std::size_t n) {
+    run_queue work;
+    for (std::size_t i = 0; i < n; ++i) {
+        work.add_task([a = 2, b = 3, c = static_cast<int>(i)](run_queue*) {
+                multiply(a, b, [c](int product) { detail::sink = product + c; });
+            });
+    }
+    work.run();
+}
+
+//
+// cb_as_coro.cpp: a coroutine per computation, awaiting an inline multiply
+//
+
+await_return_object<> inline_muladd(int c) {
+    int a = 2;
+    int b = 3;
+    int product = co_await make_my_awaitable([a,b]() { return a*b; });
+    detail::sink = product + c;
+}
+
+void coroutine_muladd(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto coro = inline_muladd(static_cast<int>(i));
+    }
+}
+
+//
+// callback_awaitable.hpp over the callback-style multiply: one coroutine doing
+// n awaits, so anything allocated per op is from the adapter.
+// The callback comes either immediately or from a run_queue task
+//
+
+await_return_object<> adapted_muladd_loop(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        int product = co_await make_callback_awaitable<int>(
+            [](int a, int b, auto cb) { multiply(a, b, cb); }, 2, 3);
+        detail::sink = product + static_cast<int>(i);
+    }
+}
+
+void adapter_sync_muladd(std::size_t n) {
+    auto coro = adapted_muladd_loop(n);
+}
+
+await_return_object<> adapted_queued_muladd_loop(run_queue& q, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        int product = co_await make_callback_awaitable<int>(
+            [&q](int a, int b, auto cb) {
+                q.add_task([=](run_queue*) { multiply(a, b, cb); });
+            }, 2, 3);
+        detail::sink = product + static_cast<int>(i);
+    }
+}
+
+void adapter_queued_muladd(std::size_t n) {
+    run_queue work;
+    auto coro = adapted_queued_muladd_loop(work, n);
+    work.run();
+}
+
+//
+// Task hop: suspend and get resumed from run_queue, vs. queueing a callback
+//
+
+struct run_queue_hop {
+    run_queue* queue_;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::experimental::coroutine_handle<> h) {
+        queue_->add_task([h](run_queue*) { h.resume(); });
+    }
+    void await_resume() const noexcept {}
+};
+
+await_return_object<> hop_loop(run_queue& q, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        co_await run_queue_hop{&q};
+    }
+}
+
+void coroutine_hops(std::size_t n) {
+    run_queue work;
+    auto coro = hop_loop(work, n);
+    work.run();
+}
+
+// the same with run_queue's metrics collection on
+void measured_coroutine_hops(std::size_t n) {
+    run_queue work;
+    work.enable_metrics();
+    auto coro = hop_loop(work, n);
+    work.run();
+}
+
+// the callback equivalent: each task queues the next one
+void callback_hops(std::size_t n) {
+    struct hopper {
+        std::size_t remaining;
+        void operator()(run_queue* q) {
+            if (--remaining != 0) {
+                q->add_task(*this);
+            }
+        }
+    };
+    run_queue work;
+    work.add_task(hopper{n});
+    work.run();
+}
+
+//
+// Resume: the awaiter stores the handle and someone else resumes it,
+// as awaitable_signal does when a signal arrives
+//
+
+struct parked {
+    std::experimental::coroutine_handle<>* slot_;
+
+    bool await_ready() const noexcept { return false; }
+    void await_suspend(std::experimental::coroutine_handle<> h) noexcept { *slot_ = h; }
+    void await_resume() const noexcept {}
+};
+
+await_return_object<> park_loop(std::experimental::coroutine_handle<>& slot) {
+    while (true) {
+        co_await parked{&slot};
+        detail::sink = detail::sink + 1;
+    }
+}
+
+void coroutine_resumes(std::size_t n) {
+    std::experimental::coroutine_handle<> h;
+    auto coro = park_loop(h);
+    for (std::size_t i = 0; i < n; ++i) {
+        h.resume();
+    }
+}
+
+//
+// Generator yield, using the same design as manual_generator.cpp
+//
+
+struct int_generator {
+    struct promise_type {
+        auto initial_suspend() const noexcept { return std::experimental::suspend_never(); }
+        auto final_suspend() const noexcept { return std::experimental::suspend_always(); }
+        void return_void() const noexcept {}
+        int_generator get_return_object() { return int_generator(*this); }
+        auto yield_value(int value) {
+            m_current_value = value;
+            return std::experimental::suspend_always();
+        }
+        void unhandled_exception() {}
+
+        int m_current_value = -1;
+    };
+
+    int_generator(promise_type & p) : m_coro(std::experimental::coroutine_handle<promise_type>::from_promise(p)) {}
+    int_generator(int_generator const&) = delete;
+    int_generator(int_generator && other) : m_coro(other.m_coro) {
+        other.m_coro = nullptr;
+    }
+    ~int_generator() {
+        if (m_coro)
+            m_coro.destroy();
+    }
+
+    int value() const { return m_coro.promise().m_current_value; }
+    void advance() { m_coro.resume(); }
+
+private:
+    std::experimental::coroutine_handle<promise_type> m_coro;
+};
+
+int_generator counter() {
+    int i = 0;
+    while (true) {
+        co_yield i++;
+    }
+}
+
+void generator_yields(std::size_t n) {
+    auto g = counter();
+    for (std::size_t i = 0; i < n; ++i) {
+        g.advance();
+        detail::sink = g.value();
+    }
+}
+
+void generator_creates(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto g = counter();
+        detail::sink = g.value();
+    }
+}
+
+//
+// Mutex and semaphore: uncontended, and capping concurrent work on a run_queue
+//
+
+await_return_object<> lock_loop(async_mutex& m, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        co_await m.lock();
+        detail::sink = static_cast<int>(i);
+        m.unlock();
+    }
+}
+
+void uncontended_locks(std::size_t n) {
+    async_mutex m;
+    auto coro = lock_loop(m, n);
+}
+
+// each worker takes a permit, then hops through the queue (its "backend call") holding it
+await_return_object<> capped_worker(async_semaphore& s, run_queue& q, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        auto permit = co_await s.scoped_acquire();
+        co_await run_queue_hop{&q};
+    }
+}
+
+void capped_hops(std::size_t n) {
+    constexpr std::size_t workers = 100;
+    async_semaphore s(8);
+    run_queue work;
+    std::vector<await_return_object<>> coros;
+    coros.reserve(workers);
+    for (std::size_t i = 0; i < workers; ++i) {
+        coros.push_back(capped_worker(s, work, n / workers));
+    }
+    work.run();
+}
+
+// the same work as scoped tasks: at most 8 in flight, frames freed as they finish
+scoped_task capped_task(run_queue& q) {
+    co_await run_queue_hop{&q};
+}
+
+await_return_object<> spawn_all(async_scope& scope, run_queue& q, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        co_await scope.spawn(capped_task(q));
+    }
+    co_await scope.join();
+}
+
+void scoped_hops(std::size_t n) {
+    async_scope scope(8);
+    run_queue work;
+    auto coro = spawn_all(scope, work, n);
+    work.run();
+}
+
+//
+// Request/response correlation: a oneshot in the awaiting frame, vs. std::promise/future
+//
+
+await_return_object<> request_loop(oneshot<int>::sender_t& pending, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        oneshot<int> reply;
+        pending = reply.sender();
+        detail::sink = co_await reply;
+    }
+}
+
+void oneshot_replies(std::size_t n) {
+    oneshot<int>::sender_t pending{};
+    auto coro = request_loop(pending, n);
+    for (std::size_t i = 0; i < n; ++i) {
+        pending.set_value(static_cast<int>(i));    // the "response" resumes the requester
+    }
+}
+
+void promise_future_replies(std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        std::promise<int> reply;
+        auto result = reply.get_future();
+        reply.set_value(static_cast<int>(i));
+        detail::sink = result.get();
+    }
+}
+
+#ifdef CORO_TRACE
+// the cost of a single trace event; compare the other results with and
+// without CORO_TRACE for the cost in context
+void trace_records(std::size_t n) {
+    int frame;
+    for (std::size_t i = 0; i < n; ++i) {
+        coro_trace::record(coro_trace::kind::resume, &frame);
+    }
+}
+#endif
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 1000000);
+
+    // creation benchmarks allocate exactly one frame per op, so
+    // their bytes_per_op is the frame size for that coroutine type
+    bench::report(std::cout, bench::measure("muladd/callback_run_queue", n, callback_muladd));
+    bench::report(std::cout, bench::measure("muladd/coroutine_inline",   n, coroutine_muladd));
+    bench::report(std::cout, bench::measure("muladd/adapter_sync",       n, adapter_sync_muladd));
+    bench::report(std::cout, bench::measure("muladd/adapter_run_queue",  n, adapter_queued_muladd));
+    bench::report(std::cout, bench::measure("hop/callback_run_queue",    n, callback_hops));
+    bench::report(std::cout, bench::measure("hop/coroutine_run_queue",   n, coroutine_hops));
+    bench::report(std::cout, bench::measure("hop/coroutine_run_queue_metrics", n, measured_coroutine_hops));
+    bench::report(std::cout, bench::measure("mutex/uncontended",         n, uncontended_locks));
+    bench::report(std::cout, bench::measure("semaphore/capped_hops",     n, capped_hops));
+    bench::report(std::cout, bench::measure("scope/capped_spawns",       n, scoped_hops));
+    bench::report(std::cout, bench::measure("reply/oneshot",             n, oneshot_replies));
+    bench::report(std::cout, bench::measure("reply/promise_future",      n, promise_future_replies));
+    bench::report(std::cout, bench::measure("resume/parked_handle",      n, coroutine_resumes));
+    bench::report(std::cout, bench::measure("generator/yield",           n, generator_yields));
+    bench::report(std::cout, bench::measure("generator/create",          n, generator_creates));
+#ifdef CORO_TRACE
+    bench::report(std::cout, bench::measure("trace/record",              n, trace_records));
+#endif
+}
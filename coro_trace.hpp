@@ -0,0 +1,451 @@
+// Recording coroutine lifecycle events, for viewing in Chrome's trace viewer or Perfetto
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef CORO_TRACE_HPP
+#define CORO_TRACE_HPP
+
+// Our promise types inherit from coro_trace::promise_hooks. Unless CORO_TRACE
+// is defined that is an empty base with empty inline functions, so tracing
+// costs nothing at all. With CORO_TRACE defined, each coroutine records:
+//   create   when it is started
+//   suspend  at each co_await (and co_yield) that suspends, naming the awaiter type
+//   resume   when it continues from one
+//   final    when it runs off the end
+//   destroy  when its frame goes away
+// plus a label, if the coroutine gives itself one with CORO_TRACE_LABEL("name").
+// co_await goes through the promise's await_transform, so every awaiter is
+// covered without changing it.
+//
+// Each event is a timestamp, the frame address, and a label or awaiter name,
+// written to a ring buffer belonging to the recording thread (so there is no
+// locking or atomic read-modify-write). Rings keep the most recent events.
+// write_chrome_trace() merges the rings into Chrome trace JSON, also read by
+// Perfetto. It is meant to run when the traced threads are quiet; if the
+// environment variable CORO_TRACE_FILE is set, the trace is written there at exit.
+//
+// CORO_TRACE_RING sets the events kept per thread (a power of two).
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <ostream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <utility>
+#include <vector>
+#include <experimental/coroutine>
+
+#if defined(__GNUC__) || defined(__clang__)
+#include <cxxabi.h>
+#endif
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define CORO_TRACE_TSC
+#elif defined(_M_X64) || defined(_M_IX86)
+#include <intrin.h>
+#define CORO_TRACE_TSC
+#endif
+
+#ifndef CORO_TRACE_RING
+#define CORO_TRACE_RING 65536
+#endif
+
+namespace coro_trace {
+
+enum class kind : std::uint8_t { create, suspend, resume, final, destroy, label };
+
+struct event {
+    std::uint64_t ticks;
+    void const*   frame;
+    char const*   what;     // a label, or the mangled name of an awaiter type
+    kind          type;
+};
+
+struct ring {
+    static constexpr std::size_t capacity = CORO_TRACE_RING;
+    static_assert((capacity & (capacity - 1)) == 0, "CORO_TRACE_RING must be a power of two");
+
+    explicit ring(unsigned t) : tid(t) {}
+
+    // only the owning thread writes
+    void push(event const& e) noexcept {
+        auto h = head.load(std::memory_order_relaxed);
+        events[h & (capacity - 1)] = e;
+        head.store(h + 1, std::memory_order_release);
+    }
+
+    unsigned const tid;
+    std::atomic<std::uint64_t> head{0};
+    event events[capacity];
+};
+
+namespace detail {
+
+// Timestamps come from the CPU's timestamp counter where there is one, since
+// reading steady_clock costs more than everything else in an event put together.
+// Ticks are converted to time on export, against steady_clock.
+inline std::uint64_t ticks() noexcept {
+#ifdef CORO_TRACE_TSC
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+}
+
+struct clock_point {
+    std::uint64_t ticks;
+    std::chrono::steady_clock::time_point time;
+
+    static clock_point now() noexcept {
+        return clock_point{detail::ticks(), std::chrono::steady_clock::now()};
+    }
+};
+
+// every ring ever made. Rings are never freed, so events from threads that
+// have exited can still be written out
+struct registry {
+    std::mutex mutex;
+    std::vector<ring*> rings;
+    clock_point start = clock_point::now();
+};
+
+inline registry& rings() {
+    static registry* r = new registry;
+    return *r;
+}
+
+inline ring& this_thread_ring() {
+    thread_local ring* r = [] {
+        auto& reg = rings();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.rings.push_back(new ring(static_cast<unsigned>(reg.rings.size() + 1)));
+        return reg.rings.back();
+    }();
+    return *r;
+}
+
+}
+
+inline void record(kind type, void const* frame, char const* what = nullptr) noexcept {
+    detail::this_thread_ring().push(event{detail::ticks(), frame, what, type});
+}
+
+//
+// Export
+//
+
+namespace detail {
+
+inline std::string readable(char const* mangled) {
+#if defined(__GNUC__) || defined(__clang__)
+    int status = 0;
+    std::unique_ptr<char, void(*)(void*)> name(abi::__cxa_demangle(mangled, nullptr, nullptr, &status), std::free);
+    if (status == 0) {
+        return name.get();
+    }
+#endif
+    return mangled;
+}
+
+inline std::string json_escaped(std::string const& s) {
+    std::string out;
+    for (char c : s) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+        }
+        out += c;
+    }
+    return out;
+}
+
+}
+
+// Coroutines appear as async tracks (one per frame, from create to destroy)
+// and their running periods as slices on the threads that ran them.
+// Frames are reused, so each create starts a new instance of its address.
+inline void write_chrome_trace(std::ostream& os) {
+    struct stamped {
+        event e;
+        unsigned tid;
+    };
+    std::vector<stamped> all;
+    double us_per_tick = 0.0;
+    {
+        auto& reg = detail::rings();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        auto end = detail::clock_point::now();
+        if (end.ticks != reg.start.ticks) {
+            us_per_tick = std::chrono::duration<double, std::micro>(end.time - reg.start.time).count() /
+                static_cast<double>(end.ticks - reg.start.ticks);
+        }
+        for (ring* r : reg.rings) {
+            auto head = r->head.load(std::memory_order_acquire);
+            auto first = head > ring::capacity ? head - ring::capacity : 0;
+            for (auto i = first; i < head; ++i) {
+                all.push_back({r->events[i & (ring::capacity - 1)], r->tid});
+            }
+        }
+    }
+    std::stable_sort(all.begin(), all.end(),
+                     [](stamped const& a, stamped const& b) { return a.e.ticks < b.e.ticks; });
+
+    // first pass: number the instances of each frame address, and find their labels
+    std::map<void const*, std::size_t> current;
+    std::vector<std::size_t> instance(all.size());
+    std::vector<std::string> labels;
+    for (std::size_t i = 0; i < all.size(); ++i) {
+        auto const& e = all[i].e;
+        if (e.type == kind::create || current.count(e.frame) == 0) {
+            current[e.frame] = labels.size();
+            labels.push_back("coroutine");
+        }
+        instance[i] = current[e.frame];
+        if (e.type == kind::label && e.what) {
+            labels[instance[i]] = e.what;
+        }
+    }
+
+    // second pass: the events
+    std::uint64_t t0 = all.empty() ? 0 : all.front().e.ticks;
+    os << "{\"traceEvents\":[\n";
+    bool first = true;
+    auto write_event = [&](char const* ph, stamped const& s, std::size_t inst, std::string const& name,
+                    std::string const& args) {
+        os << (first ? "" : ",\n")
+           << "{\"ph\":\"" << ph << "\",\"name\":\"" << detail::json_escaped(name) << "\""
+           << ",\"cat\":\"coroutine\",\"pid\":1,\"tid\":" << s.tid
+           << ",\"ts\":" << static_cast<double>(s.e.ticks - t0) * us_per_tick;
+        if (ph[0] == 'b' || ph[0] == 'e' || ph[0] == 'n') {
+            os << ",\"id\":" << inst;
+        }
+        os << ",\"args\":{\"frame\":\"" << s.e.frame << "\"" << args << "}}";
+        first = false;
+    };
+    // a coroutine destroyed while running (e.g. a generator after its last
+    // value) gets its slice closed at the destroy
+    std::vector<bool> running(labels.size(), false);
+    for (std::size_t i = 0; i < all.size(); ++i) {
+        auto const& s = all[i];
+        auto const& name = labels[instance[i]];
+        switch (s.e.type) {
+        case kind::create:
+            write_event("b", s, instance[i], name, "");
+            write_event("B", s, instance[i], name, "");
+            running[instance[i]] = true;
+            break;
+        case kind::suspend: {
+            std::string awaiter = s.e.what ? detail::json_escaped(detail::readable(s.e.what)) : "";
+            write_event("n", s, instance[i], "suspend", ",\"awaiter\":\"" + awaiter + "\"");
+            write_event("E", s, instance[i], name, "");
+            running[instance[i]] = false;
+            break;
+        }
+        case kind::resume:
+            write_event("B", s, instance[i], name, "");
+            running[instance[i]] = true;
+            break;
+        case kind::final:
+            write_event("E", s, instance[i], name, "");
+            running[instance[i]] = false;
+            break;
+        case kind::destroy:
+            if (running[instance[i]]) {
+                write_event("E", s, instance[i], name, "");
+            }
+            write_event("e", s, instance[i], name, "");
+            break;
+        case kind::label:
+            break;
+        }
+    }
+    os << "\n],\"displayTimeUnit\":\"ns\"}\n";
+}
+
+//
+// Hooks for promise types
+//
+
+#ifdef CORO_TRACE
+
+namespace detail {
+
+// wraps an awaiter to record the suspension and resumption around it
+template<typename Awaiter>
+struct traced_awaiter {
+    Awaiter inner;
+    void const* frame;
+    bool suspended = false;     // so that awaits that complete immediately (await_ready,
+                                // or await_suspend returning false) record nothing
+
+    bool await_ready() {
+        return inner.await_ready();
+    }
+
+    template<typename P>
+    decltype(auto) await_suspend(std::experimental::coroutine_handle<P> h) {
+        using result_t = decltype(inner.await_suspend(h));
+        char const* what = typeid(std::remove_reference_t<Awaiter>).name();
+        if constexpr (std::is_same_v<result_t, bool>) {
+            // false means it completed after all, and we never suspended. On true
+            // we may already be resumed elsewhere, frame and all, so everything
+            // the event needs is taken beforehand and "this" is left alone
+            auto when = ticks();
+            auto f = frame;
+            suspended = true;
+            if (!inner.await_suspend(h)) {
+                suspended = false;
+                return false;
+            }
+            this_thread_ring().push(event{when, f, what, kind::suspend});
+            return true;
+        } else {
+            // recorded first, for the same reason; symmetric transfer counts as
+            // suspending, even if it hands back our own handle
+            suspended = true;
+            record(kind::suspend, frame, what);
+            return inner.await_suspend(h);
+        }
+    }
+
+    decltype(auto) await_resume() {
+        if (suspended) {
+            record(kind::resume, frame);
+        }
+        return inner.await_resume();
+    }
+};
+
+template<typename T, typename = void>
+struct has_member_co_await : std::false_type {};
+
+template<typename T>
+struct has_member_co_await<T, std::void_t<decltype(std::declval<T>().operator co_await())>> : std::true_type {};
+
+// a non-member operator co_await, found by argument-dependent lookup
+template<typename T, typename = void>
+struct has_free_co_await : std::false_type {};
+
+template<typename T>
+struct has_free_co_await<T, std::void_t<decltype(operator co_await(std::declval<T>()))>> : std::true_type {};
+
+}
+
+// records a label for the current coroutine
+struct label_t {
+    char const* name;
+};
+
+template<typename Promise>
+struct promise_hooks {
+    ~promise_hooks() {
+        record(kind::destroy, frame_);
+    }
+
+    // call from get_return_object, when the frame and promise both exist
+    void trace_create(Promise& p) noexcept {
+        frame_ = std::experimental::coroutine_handle<Promise>::from_promise(p).address();
+        record(kind::create, frame_);
+    }
+
+    // call from final_suspend
+    void trace_final() const noexcept {
+        record(kind::final, frame_);
+    }
+
+    // wrap an awaiter the promise returns itself, e.g. from yield_value
+    template<typename Awaiter>
+    detail::traced_awaiter<Awaiter> traced(Awaiter a) const {
+        return detail::traced_awaiter<Awaiter>{std::move(a), frame_};
+    }
+
+    auto await_transform(label_t l) const noexcept {
+        record(kind::label, frame_, l.name);
+        return std::experimental::suspend_never();
+    }
+
+    // Everything else. Awaiters made by operator co_await, member or not, are
+    // kept by value, constructed in place; other awaitables are kept by
+    // reference, which is safe because the operand of co_await lives until it
+    // completes
+    template<typename Awaitable>
+    auto await_transform(Awaitable&& a) const {
+        if constexpr (detail::has_member_co_await<Awaitable>::value) {
+            using awaiter_t = decltype(std::forward<Awaitable>(a).operator co_await());
+            return detail::traced_awaiter<awaiter_t>{std::forward<Awaitable>(a).operator co_await(), frame_};
+        } else if constexpr (detail::has_free_co_await<Awaitable>::value) {
+            using awaiter_t = decltype(operator co_await(std::forward<Awaitable>(a)));
+            return detail::traced_awaiter<awaiter_t>{operator co_await(std::forward<Awaitable>(a)), frame_};
+        } else {
+            return detail::traced_awaiter<Awaitable&>{a, frame_};
+        }
+    }
+
+private:
+    void const* frame_ = nullptr;
+};
+
+#define CORO_TRACE_LABEL(name) co_await ::coro_trace::label_t{name}
+
+namespace detail {
+
+// writes the trace at exit, if asked to
+struct exit_writer {
+    ~exit_writer() {
+        if (char const* path = std::getenv("CORO_TRACE_FILE")) {
+            std::ofstream out(path);
+            write_chrome_trace(out);
+        }
+    }
+};
+
+inline exit_writer write_at_exit;
+
+}
+
+#else
+
+template<typename Promise>
+struct promise_hooks {
+    void trace_create(Promise&) noexcept {}
+    void trace_final() const noexcept {}
+
+    template<typename Awaiter>
+    Awaiter traced(Awaiter a) const { return a; }
+};
+
+#define CORO_TRACE_LABEL(name)
+
+#endif // CORO_TRACE
+
+}
+
+#endif // CORO_TRACE_HPP
@@ -0,0 +1,288 @@
+// Frame memory per coroutine type: bytes, live and peak counts, via promise operator new/delete
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef FRAME_STATS_HPP
+#define FRAME_STATS_HPP
+
+// Our promise types inherit from frame_stats::accounted. Unless
+// CORO_FRAME_STATS is defined that is an empty base, frames come from the
+// global operator new as before, and nothing is counted. A promise whose
+// frames come from somewhere else names that base as the second parameter,
+// e.g. accounted<promise_type, numa::node_frames>: without the macro it is
+// just that base, and with it the counting wraps that base's operator new
+// and (unsized) delete. With it defined the
+// base supplies the promise's operator new and delete, which count, for each
+// promise type and frame size:
+//   allocations  frames ever allocated
+//   live         frames allocated and not yet freed (e.g. suspended coroutines)
+//   peak         the most that were ever live at once
+// Coroutines that share a promise type (every await_return_object<>, say)
+// usually differ in frame size, so each size gets its own line, along with
+// the function that first allocated a frame of that size: the coroutine
+// itself, as frames are allocated from its ramp. Function names need the
+// executable's symbols exported (the CMake option does that).
+//
+// Counting is a few relaxed atomic operations per frame, on counters shared
+// by every thread making that kind of coroutine.
+//
+// snapshot() returns the counts and report() prints them, largest peak
+// memory first. If the environment variable CORO_FRAME_REPORT is set, the
+// report is written at exit: to that file, or to stderr if it is "-".
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <new>
+#include <ostream>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include <typeinfo>
+#include <vector>
+
+#include "coro_trace.hpp"
+
+#if defined(CORO_FRAME_STATS) && defined(__has_include)
+#if __has_include(<dlfcn.h>)
+#include <dlfcn.h>
+#define CORO_FRAME_STATS_DLADDR
+#endif
+#endif
+
+namespace frame_stats {
+
+struct counts {
+    std::string type;           // the promise type
+    std::string site;           // where the first frame of this size was allocated
+    std::size_t frame_bytes;    // zero for "every other size", when a type has too many
+    std::size_t allocations;
+    std::size_t live;
+    std::size_t peak;
+};
+
+namespace detail {
+
+struct entry {
+    char const* type = nullptr;
+    std::atomic<std::size_t> size{0};
+    std::atomic<void*> site{nullptr};
+    std::atomic<std::size_t> allocations{0};
+    std::atomic<std::size_t> live{0};
+    std::atomic<std::size_t> peak{0};
+
+    void allocated(void* from) noexcept {
+        allocations.fetch_add(1, std::memory_order_relaxed);
+        auto now = live.fetch_add(1, std::memory_order_relaxed) + 1;
+        auto high = peak.load(std::memory_order_relaxed);
+        while (now > high && !peak.compare_exchange_weak(high, now, std::memory_order_relaxed)) {
+        }
+        void* none = nullptr;
+        if (from && !site.load(std::memory_order_relaxed)) {
+            site.compare_exchange_strong(none, from, std::memory_order_relaxed);
+        }
+    }
+
+    void freed() noexcept {
+        live.fetch_sub(1, std::memory_order_relaxed);
+    }
+};
+
+// every entry in use, for the report; entries live for the whole program
+struct registry {
+    std::mutex mutex;
+    std::vector<entry const*> entries;
+};
+
+inline registry& entries() {
+    static registry* r = new registry;
+    return *r;
+}
+
+// one per promise type: an entry for each of the first few frame sizes seen,
+// found by a lock-free search, and one for all the others
+template<typename Promise>
+struct table {
+    static constexpr std::size_t sizes = 16;
+
+    static entry& get(std::size_t size) noexcept {
+        static table* t = new table;
+        for (auto& e : t->by_size) {
+            auto s = e.size.load(std::memory_order_acquire);
+            if (s == size) {
+                return e;
+            }
+            if (s == 0 && e.size.compare_exchange_strong(s, size, std::memory_order_acq_rel)) {
+                add(e);
+                return e;
+            }
+            if (s == size) {
+                return e;   // someone else just claimed it for this size
+            }
+        }
+        std::call_once(t->other_added, []() { add(t->other); });
+        return t->other;
+    }
+
+private:
+    static void add(entry& e) {
+        e.type = typeid(Promise).name();
+        auto& reg = entries();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.entries.push_back(&e);
+    }
+
+    entry by_size[sizes];
+    entry other;
+    std::once_flag other_added;
+};
+
+inline std::string symbol(void* address) {
+    if (!address) {
+        return "";
+    }
+#ifdef CORO_FRAME_STATS_DLADDR
+    Dl_info info;
+    if (::dladdr(address, &info) && info.dli_sname) {
+        return coro_trace::detail::readable(info.dli_sname);
+    }
+#endif
+    std::ostringstream os;
+    os << address;
+    return os.str();
+}
+
+}
+
+#ifdef CORO_FRAME_STATS
+
+template<typename Promise, typename Frames = void>
+struct accounted {
+    // not inlined, so that the return address is in the coroutine's ramp
+#if defined(__GNUC__) || defined(__clang__)
+    [[gnu::noinline]] static void* operator new(std::size_t size) {
+        void* from = __builtin_extract_return_addr(__builtin_return_address(0));
+#else
+    static void* operator new(std::size_t size) {
+        void* from = nullptr;
+#endif
+        void* p;
+        if constexpr (std::is_void_v<Frames>) {
+            p = ::operator new(size);
+        } else {
+            p = Frames::operator new(size);
+        }
+        detail::table<Promise>::get(size).allocated(from);
+        return p;
+    }
+
+    // sized, so the frame's size comes back to us
+    static void operator delete(void* p, std::size_t size) noexcept {
+        detail::table<Promise>::get(size).freed();
+        if constexpr (std::is_void_v<Frames>) {
+            ::operator delete(p);
+        } else {
+            Frames::operator delete(p);
+        }
+    }
+};
+
+#else
+
+template<typename Promise, typename Frames = void>
+struct accounted : Frames {};
+
+template<typename Promise>
+struct accounted<Promise, void> {};
+
+#endif // CORO_FRAME_STATS
+
+inline std::vector<counts> snapshot() {
+    std::vector<counts> out;
+    auto& reg = detail::entries();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    for (auto e : reg.entries) {
+        out.push_back(counts{coro_trace::detail::readable(e->type),
+                             detail::symbol(e->site.load(std::memory_order_relaxed)),
+                             e->size.load(std::memory_order_relaxed),
+                             e->allocations.load(std::memory_order_relaxed),
+                             e->live.load(std::memory_order_relaxed),
+                             e->peak.load(std::memory_order_relaxed)});
+    }
+    std::sort(out.begin(), out.end(), [](counts const& a, counts const& b) {
+        return a.peak * a.frame_bytes > b.peak * b.frame_bytes;
+    });
+    return out;
+}
+
+inline void report(std::ostream& os) {
+#ifndef CORO_FRAME_STATS
+    os << "frame accounting is off: build with CORO_FRAME_STATS\n";
+#else
+    std::size_t live_bytes = 0;
+    os << std::setw(8) << "frame" << std::setw(12) << "allocated" << std::setw(10) << "live"
+       << std::setw(10) << "peak" << std::setw(12) << "peak bytes" << "  promise type / coroutine\n";
+    for (auto const& c : snapshot()) {
+        os << std::setw(8) << (c.frame_bytes ? std::to_string(c.frame_bytes) : "other")
+           << std::setw(12) << c.allocations << std::setw(10) << c.live << std::setw(10) << c.peak
+           << std::setw(12) << c.peak * c.frame_bytes << "  " << c.type << "\n";
+        if (!c.site.empty()) {
+            os << std::setw(54) << "" << "  " << c.site << "\n";
+        }
+        live_bytes += c.live * c.frame_bytes;
+    }
+    os << live_bytes << " bytes in live frames (of the sizes tracked)\n";
+#endif
+}
+
+#ifdef CORO_FRAME_STATS
+
+namespace detail {
+
+// writes the report at exit, if asked to
+struct exit_reporter {
+    ~exit_reporter() {
+        if (char const* path = std::getenv("CORO_FRAME_REPORT")) {
+            if (std::string(path) == "-") {
+                report(std::cerr);
+            } else {
+                std::ofstream out(path);
+                report(out);
+            }
+        }
+    }
+};
+
+inline exit_reporter report_at_exit;
+
+}
+
+#endif // CORO_FRAME_STATS
+
+}
+
+#endif // FRAME_STATS_HPP
@@ -0,0 +1,132 @@
+// A fixed-size log-linear latency histogram, in the style of HdrHistogram
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef HISTOGRAM_HPP
+#define HISTOGRAM_HPP
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <limits>
+
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+
+// Values below 2^SubBits are counted exactly. Above that, each power-of-two
+// range is divided into 2^SubBits equal buckets, so every recorded value is
+// known to within 1/2^SubBits of itself (about 3% for the default of 5)
+// across the whole 64-bit range, in a fixed-size array: recording is an
+// index computation and an increment, with no allocation.
+// One histogram is meant to be written by one thread; merge() combines them.
+
+template<unsigned SubBits = 5>
+struct log_linear_histogram {
+    static constexpr unsigned sub_count = 1u << SubBits;
+    static constexpr unsigned bucket_count = (65 - SubBits) * sub_count;
+
+    void record(std::uint64_t v) noexcept {
+        ++counts_[index(v)];
+        ++total_;
+        sum_ += v;
+        min_ = std::min(min_, v);
+        max_ = std::max(max_, v);
+    }
+
+    void merge(log_linear_histogram const& other) noexcept {
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            counts_[i] += other.counts_[i];
+        }
+        total_ += other.total_;
+        sum_   += other.sum_;
+        min_    = std::min(min_, other.min_);
+        max_    = std::max(max_, other.max_);
+    }
+
+    void reset() noexcept {
+        *this = log_linear_histogram{};
+    }
+
+    std::uint64_t count() const noexcept { return total_; }
+    std::uint64_t min() const noexcept { return total_ ? min_ : 0; }
+    std::uint64_t max() const noexcept { return max_; }
+    double mean() const noexcept {
+        return total_ ? static_cast<double>(sum_) / static_cast<double>(total_) : 0.0;
+    }
+
+    // the highest value equivalent (within our precision) to the given percentile
+    std::uint64_t percentile(double p) const noexcept {
+        if (total_ == 0) {
+            return 0;
+        }
+        auto target = static_cast<std::uint64_t>(p / 100.0 * static_cast<double>(total_) + 0.5);
+        target = std::max<std::uint64_t>(target, 1);
+        std::uint64_t seen = 0;
+        for (unsigned i = 0; i < bucket_count; ++i) {
+            seen += counts_[i];
+            if (seen >= target) {
+                return std::min(highest_equivalent(i), max_);
+            }
+        }
+        return max_;
+    }
+
+private:
+    static unsigned msb(std::uint64_t v) noexcept {
+#if defined(_MSC_VER)
+        unsigned long idx;
+        _BitScanReverse64(&idx, v);
+        return static_cast<unsigned>(idx);
+#else
+        return 63u - static_cast<unsigned>(__builtin_clzll(v));
+#endif
+    }
+
+    static unsigned index(std::uint64_t v) noexcept {
+        if (v < sub_count) {
+            return static_cast<unsigned>(v);
+        }
+        unsigned shift = msb(v) - SubBits;
+        // v >> shift is in [sub_count, 2*sub_count)
+        return (shift + 1) * sub_count + static_cast<unsigned>((v >> shift) - sub_count);
+    }
+
+    static std::uint64_t highest_equivalent(unsigned idx) noexcept {
+        if (idx < sub_count) {
+            return idx;
+        }
+        unsigned shift = idx / sub_count - 1;
+        std::uint64_t lowest = static_cast<std::uint64_t>(sub_count + idx % sub_count) << shift;
+        return lowest + ((std::uint64_t{1} << shift) - 1);
+    }
+
+    std::array<std::uint64_t, bucket_count> counts_{};
+    std::uint64_t total_ = 0;
+    std::uint64_t sum_   = 0;
+    std::uint64_t min_   = std::numeric_limits<std::uint64_t>::max();
+    std::uint64_t max_   = 0;
+};
+
+using latency_histogram = log_linear_histogram<>;
+
+#endif // HISTOGRAM_HPP
@@ -0,0 +1,125 @@
+// A pool of single-threaded io_contexts, one per core
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef IO_CONTEXT_POOL_HPP
+#define IO_CONTEXT_POOL_HPP
+
+// Instead of one io_context run by many threads (which then contend on its
+// reactor and require strands to protect coroutine state) we make one io_context
+// per core, each run by exactly one thread pinned to that core. A coroutine
+// co_spawned onto a shard gets that shard's executor from this_coro::executor,
+// so everything it awaits completes on the same thread: no locks, no strands.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <memory>
+#include <thread>
+#include <vector>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+struct io_context_pool {
+    // zero means one shard per hardware thread
+    explicit io_context_pool(std::size_t shards = 0) {
+        if (shards == 0) {
+            shards = std::max(1u, std::thread::hardware_concurrency());
+        }
+        contexts_.reserve(shards);
+        for (std::size_t i = 0; i < shards; ++i) {
+            // a concurrency hint of 1 tells Asio only one thread runs this context,
+            // so it can skip some internal locking
+            contexts_.push_back(std::make_unique<boost::asio::io_context>(1));
+        }
+    }
+
+    io_context_pool(io_context_pool const&) = delete;
+
+    std::size_t size() const noexcept { return contexts_.size(); }
+
+    // round-robin shard selection, for work with no affinity of its own
+    boost::asio::io_context& next() noexcept {
+        return *contexts_[next_.fetch_add(1, std::memory_order_relaxed) % contexts_.size()];
+    }
+
+    // keyed selection, so related work (e.g. everything for one client) shares a shard
+    boost::asio::io_context& shard(std::size_t key) noexcept {
+        return *contexts_[key % contexts_.size()];
+    }
+
+    // for servers: as run(), but idle shards keep waiting for work until stop()
+    void run_until_stopped() {
+        using guard_t = boost::asio::executor_work_guard<boost::asio::io_context::executor_type>;
+        std::vector<guard_t> guards;
+        guards.reserve(contexts_.size());
+        for (auto & ctx : contexts_) {
+            guards.push_back(boost::asio::make_work_guard(*ctx));
+        }
+        run();
+    }
+
+    // run every shard on its own pinned thread, returning when all have run out of work
+    void run() {
+        std::vector<std::thread> threads;
+        threads.reserve(contexts_.size());
+        for (std::size_t i = 0; i < contexts_.size(); ++i) {
+            threads.emplace_back([this, i]() {
+                    pin_to_core(i);
+                    contexts_[i]->run();
+                });
+        }
+        for (auto & t : threads) {
+            t.join();
+        }
+    }
+
+    void stop() {
+        for (auto & ctx : contexts_) {
+            ctx->stop();
+        }
+    }
+
+private:
+    static void pin_to_core(std::size_t i) {
+#ifdef __linux__
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(static_cast<int>(i % std::max(1u, std::thread::hardware_concurrency())), &cpus);
+        // failure (e.g. a restricted cpuset) just leaves the thread unpinned
+        pthread_setaffinity_np(pthread_self(), sizeof(cpus), &cpus);
+#else
+        (void)i;
+#endif
+    }
+
+    std::vector<std::unique_ptr<boost::asio::io_context>> contexts_;
+    std::atomic<std::size_t> next_{0};
+};
+
+#endif // IO_CONTEXT_POOL_HPP
@@ -26,6 +26,9 @@ SOFTWARE.
 #include <iostream>
 #include <experimental/coroutine>
 
+#include "coro_trace.hpp"
+#include "frame_stats.hpp"
+
 namespace detail
 {
 // a piece of state accessible to all generators
@@ -43,7 +46,9 @@ struct my_return {
 
     // the "promise type" has to be defined or declared here - it is a requirement
     // of the coroutine machinery and must have certain specific methods
-    struct promise_type {
+    // (the bases record this coroutine's lifecycle when built with CORO_TRACE,
+    // and count its frames when built with CORO_FRAME_STATS)
+    struct promise_type : coro_trace::promise_hooks<promise_type>, frame_stats::accounted<promise_type> {
 
         promise_type() : m_current_value(-1) {}
 
@@ -61,18 +66,20 @@ struct my_return {
             // choose "never" if it runs off the end and destroys itself
             // our coroutine has an infinite loop so we will never get here but
             // for the sake of form:
+            this->trace_final();
             return std::experimental::suspend_always();
         }
 
         void return_void() const noexcept {}
 
         my_return get_return_object() {
+            this->trace_create(*this);
             return my_return(*this);
         }
 
         auto yield_value(int value) {
             m_current_value = value;
-            return std::experimental::suspend_always();
+            return this->traced(std::experimental::suspend_always());
         }
 
         void unhandled_exception() {}  // do nothing :)
@@ -24,8 +24,11 @@ SOFTWARE.
 #ifndef UTIL_HPP
 #define UTIL_HPP
 
+#include <array>
+#include <cstddef>
 #include <tuple>
 #include <type_traits>
+#include <utility>
 
 //
 // Extract object type, return type, and parameters from member function
@@ -58,25 +61,60 @@ struct apply_to_tuple<MF, std::tuple<Elements...>> {
 //
 // Filter types in a std::tuple by a template template "predicate"
 //
+// Done without recursion, so the instantiation depth doesn't grow with the
+// number of types and each filter costs a fixed number of instantiations
+// (plus the predicate for each type) rather than one per element with a
+// tuple_cat at each level. The kept elements' positions are computed by a
+// constexpr function, then picked out with nth_t, which is also non-recursive.
+//
+
+// the Nth type in a pack: overload resolution finds the one base class
+// with index N, so no recursion is needed
+template<std::size_t N, typename T>
+struct indexed_type {
+    using type = T;
+};
+
+template<typename Indices, typename... Ts>
+struct indexed_types;
+
+template<std::size_t... Indices, typename... Ts>
+struct indexed_types<std::index_sequence<Indices...>, Ts...> : indexed_type<Indices, Ts>... {};
+
+template<std::size_t N, typename T>
+indexed_type<N, T> select_indexed(indexed_type<N, T>);
+
+template<std::size_t N, typename... Ts>
+using nth_t = typename decltype(select_indexed<N>(indexed_types<std::index_sequence_for<Ts...>, Ts...>{}))::type;
 
 template<template<typename> class Predicate,
          typename Sequence>
 struct filter;
 
 template<template<typename> class Predicate,
-         typename Head,
          typename... Elements>
-struct filter<Predicate, std::tuple<Head, Elements...>> {
-    using type=std::conditional_t<Predicate<Head>::value,
-                                  decltype(std::tuple_cat(std::declval<std::tuple<Head>>(),
-                                                          std::declval<typename filter<Predicate, std::tuple<Elements...>>::type>())),
-                                  typename filter<Predicate, std::tuple<Elements...>>::type>;
-};
-
-// terminate recursion
-template<template<typename> class Predicate>
-struct filter<Predicate, std::tuple<>> {
-    using type = std::tuple<>;
+struct filter<Predicate, std::tuple<Elements...>> {
+private:
+    static constexpr std::size_t count = (std::size_t{0} + ... + (Predicate<Elements>::value ? 1 : 0));
+
+    // positions of the elements to keep, in order
+    static constexpr std::array<std::size_t, count> kept() {
+        constexpr bool keep[] = {Predicate<Elements>::value..., false};    // never empty
+        std::array<std::size_t, count> result{};
+        std::size_t j = 0;
+        for (std::size_t i = 0; i < sizeof...(Elements); ++i) {
+            if (keep[i]) {
+                result[j++] = i;
+            }
+        }
+        return result;
+    }
+
+    template<std::size_t... I>
+    static std::tuple<nth_t<kept()[I], Elements...>...> pick(std::index_sequence<I...>);
+
+public:
+    using type = decltype(pick(std::make_index_sequence<count>()));
 };
 
 #endif  // UTIL_HPP
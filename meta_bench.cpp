@@ -0,0 +1,91 @@
+// Compile-time benchmark: the metaprogramming behind hundreds of distinct signal awaitables
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Nothing interesting happens at run time; what's measured is how long this
+// file takes to compile. It instantiates qtcoro's awaitable types, and with
+// them member_fn_t, filter, and apply_to_tuple, for META_BENCH_SIGNALS
+// distinct signal signatures of up to META_BENCH_ARITY parameters each,
+// every one ending in an empty tag type as Qt's private signals do.
+// For example:
+//
+//   touch meta_bench.cpp && time make metabench
+//
+// or compile it with -ftime-report (gcc, clang) or /Bt+ (MSVC).
+
+#include <cstddef>
+#include <iostream>
+#include <tuple>
+#include <utility>
+
+#include "qtcoro.hpp"
+
+#ifndef META_BENCH_SIGNALS
+#define META_BENCH_SIGNALS 300
+#endif
+
+#ifndef META_BENCH_ARITY
+#define META_BENCH_ARITY 12
+#endif
+
+// a distinct argument type for every (signal, position)
+template<std::size_t Signal, std::size_t Position>
+struct arg {
+    int value;
+};
+
+// stands in for QPrivateSignal, which qtcoro filters out
+struct private_tag {};
+
+template<std::size_t Signal>
+struct source : QObject {};
+
+// signal number S has S % (META_BENCH_ARITY + 1) real parameters
+template<std::size_t S, typename Positions>
+struct make_signal;
+
+template<std::size_t S, std::size_t... P>
+struct make_signal<S, std::index_sequence<P...>> {
+    using type = void (source<S>::*)(arg<S, P> const&..., private_tag);
+};
+
+template<std::size_t S>
+using signal_t = typename make_signal<S, std::make_index_sequence<S % (META_BENCH_ARITY + 1)>>::type;
+
+// instantiating the class types is enough to run all the metaprogramming
+template<std::size_t S>
+constexpr std::size_t instantiate() {
+    return sizeof(qtcoro::awaitable_signal<signal_t<S>>) +
+        sizeof(qtcoro::signal_stream<signal_t<S>>) +
+        std::tuple_size_v<typename qtcoro::signal_args_t<signal_t<S>>::decayed_args_t>;
+}
+
+template<std::size_t... S>
+constexpr std::size_t instantiate_all(std::index_sequence<S...>) {
+    return (std::size_t{0} + ... + instantiate<S>());
+}
+
+int main() {
+    constexpr std::size_t total = instantiate_all(std::make_index_sequence<META_BENCH_SIGNALS>());
+    std::cout << META_BENCH_SIGNALS << " signal types, up to " << META_BENCH_ARITY
+              << " parameters: " << total << "\n";
+}
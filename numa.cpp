@@ -0,0 +1,261 @@
+// Implementation of the NUMA helpers
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "numa.hpp"
+
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <exception>
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <utility>
+
+#ifdef __linux__
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace numa {
+
+namespace {
+
+// "0-3,8-11" -> 0 1 2 3 8 9 10 11
+std::vector<unsigned> parse_list(std::string const& text) {
+    std::vector<unsigned> out;
+    std::istringstream in(text);
+    std::string range;
+    while (std::getline(in, range, ',')) {
+        if (range.empty() || range == "\n") {
+            continue;
+        }
+        auto dash = range.find('-');
+        unsigned first = std::stoul(range.substr(0, dash));
+        unsigned last = dash == std::string::npos ? first : std::stoul(range.substr(dash + 1));
+        for (unsigned i = first; i <= last; ++i) {
+            out.push_back(i);
+        }
+    }
+    return out;
+}
+
+std::string read_file(std::string const& path) {
+    std::ifstream in(path);
+    std::string text;
+    std::getline(in, text);
+    return text;
+}
+
+// the kernel's numbers for our nodes, in the same order as topology::node_cpus
+std::vector<unsigned>& kernel_ids() {
+    static std::vector<unsigned> ids;
+    return ids;
+}
+
+topology detect() {
+    topology t;
+#ifdef __linux__
+    // CPUs we may run on, so a restricted cpuset (a container) is respected
+    cpu_set_t allowed;
+    CPU_ZERO(&allowed);
+    bool have_allowed = sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    try {
+        for (auto node : parse_list(read_file("/sys/devices/system/node/online"))) {
+            std::vector<unsigned> cpus;
+            auto path = "/sys/devices/system/node/node" + std::to_string(node) + "/cpulist";
+            for (auto cpu : parse_list(read_file(path))) {
+                if (!have_allowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed))) {
+                    cpus.push_back(cpu);
+                }
+            }
+            if (cpus.empty()) {
+                continue;       // memory only, or none of its CPUs are ours
+            }
+            for (auto cpu : cpus) {
+                if (cpu >= t.cpu_node.size()) {
+                    t.cpu_node.resize(cpu + 1, 0);
+                }
+                t.cpu_node[cpu] = static_cast<unsigned>(t.node_cpus.size());
+            }
+            t.node_cpus.push_back(std::move(cpus));
+            kernel_ids().push_back(node);
+        }
+    } catch (std::exception const&) {
+        t = topology();
+        kernel_ids().clear();
+    }
+#endif
+    if (t.node_cpus.empty()) {
+        // one node with every CPU
+        std::vector<unsigned> cpus;
+        for (unsigned i = 0; i < std::max(1u, std::thread::hardware_concurrency()); ++i) {
+            cpus.push_back(i);
+        }
+        t.cpu_node.assign(cpus.size(), 0);
+        t.node_cpus.push_back(std::move(cpus));
+        kernel_ids().assign(1, 0);
+    }
+    return t;
+}
+
+//
+// Frame arenas
+//
+
+// Blocks are carved from big chunks and kept, when freed, on a free list per
+// size class: multiples of 64 bytes up to 4KB. Larger frames (rare) come
+// from operator new. Each block starts with a header naming its arena.
+constexpr std::size_t granule = 64;
+constexpr std::size_t classes = 64;
+constexpr std::size_t chunk_size = 2 * 1024 * 1024;
+constexpr std::uint32_t large = 0xffffffff;
+
+struct alignas(16) header {
+    std::uint32_t node;
+    std::uint32_t cls;
+};
+
+struct free_block {
+    free_block* next;
+};
+
+struct arena {
+    std::mutex mutex;
+    std::array<free_block*, classes> free{};
+    char* next = nullptr;
+    char* end = nullptr;
+};
+
+// never destroyed, so frames freed during static destruction still have a home
+std::vector<arena*>& arenas() {
+    static auto* a = [] {
+        auto* v = new std::vector<arena*>;
+        for (std::size_t i = 0; i < topology::get().nodes(); ++i) {
+            v->push_back(new arena);
+        }
+        return v;
+    }();
+    return *a;
+}
+
+// a fresh chunk of memory, on the given node if the kernel will do that
+char* new_chunk(unsigned node) {
+#ifdef __linux__
+    void* p = ::mmap(nullptr, chunk_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        throw std::bad_alloc();
+    }
+#ifdef SYS_mbind
+    // MPOL_PREFERRED: the node's memory while it has some, elsewhere after that.
+    // If this fails we still get first-touch placement, which is usually the
+    // same thing, as the chunk is first touched by a thread on that node.
+    unsigned id = kernel_ids()[node];
+    if (id < 64) {
+        constexpr int mpol_preferred = 1;
+        unsigned long mask = 1ul << id;
+        ::syscall(SYS_mbind, p, chunk_size, mpol_preferred, &mask, 8 * sizeof(mask) + 1, 0);
+    }
+#endif
+    return static_cast<char*>(p);
+#else
+    (void)node;
+    return static_cast<char*>(::operator new(chunk_size));
+#endif
+}
+
+}
+
+topology const& topology::get() {
+    static topology const t = detect();
+    return t;
+}
+
+unsigned current_node() noexcept {
+#ifdef __linux__
+    auto const& t = topology::get();
+    int cpu = sched_getcpu();
+    if (cpu >= 0 && static_cast<std::size_t>(cpu) < t.cpu_node.size()) {
+        return t.cpu_node[cpu];
+    }
+#endif
+    return 0;
+}
+
+void* allocate_on(unsigned node, std::size_t size) {
+    auto const& all = arenas();
+    node %= all.size();
+    auto cls = (size + sizeof(header) + granule - 1) / granule - 1;
+    if (cls >= classes) {
+        auto h = static_cast<header*>(::operator new(size + sizeof(header)));
+        *h = header{node, large};
+        return h + 1;
+    }
+
+    arena& a = *all[node];
+    std::lock_guard<std::mutex> lock(a.mutex);
+    void* block;
+    if (a.free[cls]) {
+        block = std::exchange(a.free[cls], a.free[cls]->next);
+    } else {
+        auto bytes = (cls + 1) * granule;
+        if (a.next == nullptr || static_cast<std::size_t>(a.end - a.next) < bytes) {
+            a.next = new_chunk(node);   // the rest of the old one is given up
+            a.end = a.next + chunk_size;
+        }
+        block = a.next;
+        a.next += bytes;
+    }
+    auto h = static_cast<header*>(block);
+    *h = header{node, static_cast<std::uint32_t>(cls)};
+    return h + 1;
+}
+
+void deallocate(void* p) noexcept {
+    if (!p) {
+        return;
+    }
+    auto h = static_cast<header*>(p) - 1;
+    if (h->cls == large) {
+        ::operator delete(h);
+        return;
+    }
+    arena& a = *arenas()[h->node];
+    auto cls = h->cls;
+    std::lock_guard<std::mutex> lock(a.mutex);
+    auto f = reinterpret_cast<free_block*>(h);
+    f->next = a.free[cls];
+    a.free[cls] = f;
+}
+
+}
+
+node_pools::node_pools(std::size_t threads_per_node) {
+    for (auto const& cpus : numa::topology::get().node_cpus) {
+        pools_.push_back(std::make_unique<thread_pool>(threads_per_node ? threads_per_node : cpus.size(), cpus));
+    }
+}
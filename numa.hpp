@@ -0,0 +1,99 @@
+// NUMA topology, thread pinning, node-local coroutine frames, and a pool per node
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef NUMA_HPP
+#define NUMA_HPP
+
+// On a machine with several memory nodes (sockets, usually), memory is
+// faster from the CPUs of its own node. So that a coroutine's frame sits
+// where the coroutine runs:
+//
+//  - node_pools has one thread_pool per node, its threads pinned to that
+//    node's CPUs; co_await pools.schedule_on(n) moves a coroutine there.
+//  - a promise type that derives from numa::node_frames gets its frames
+//    from an arena on the node of the CPU that creates the coroutine. So
+//    create coroutines on the node that will resume them (from a task on
+//    its pool, say) and their frames stay local from then on.
+//
+// The topology comes from /sys/devices/system/node; elsewhere, or if that
+// can't be read, the whole machine is a single node and pinning does nothing.
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <vector>
+
+#include "thread_pool.hpp"
+
+namespace numa {
+
+struct topology {
+    std::vector<std::vector<unsigned>> node_cpus;  // online CPUs of each node
+    std::vector<unsigned> cpu_node;                // and the other way round
+
+    std::size_t nodes() const noexcept { return node_cpus.size(); }
+
+    // the machine we are on, read once
+    static topology const& get();
+};
+
+// the node of the CPU this thread is running on right now
+unsigned current_node() noexcept;
+
+// Frame memory from a per-node arena. The arena's pages are bound to the
+// node, so frames are local even if the allocating thread later moves.
+// Blocks are returned to the arena they came from, whichever thread frees them.
+void* allocate_on(unsigned node, std::size_t size);
+void deallocate(void* p) noexcept;
+
+struct node_frames {
+    static void* operator new(std::size_t size) {
+        return allocate_on(current_node(), size);
+    }
+    static void operator delete(void* p) noexcept {
+        deallocate(p);
+    }
+};
+
+}
+
+// one pinned thread_pool per NUMA node
+struct node_pools {
+    // zero means as many threads as the node has CPUs
+    explicit node_pools(std::size_t threads_per_node = 0);
+    node_pools(node_pools const&) = delete;
+
+    std::size_t nodes() const noexcept { return pools_.size(); }
+
+    thread_pool& pool(unsigned node) { return *pools_[node % pools_.size()]; }
+
+    // the pool of the node we are running on
+    thread_pool& local() { return pool(numa::current_node()); }
+
+    thread_pool::schedule_awaiter schedule_on(unsigned node) { return pool(node).schedule(); }
+
+private:
+    std::vector<std::unique_ptr<thread_pool>> pools_;
+};
+
+#endif // NUMA_HPP
@@ -0,0 +1,124 @@
+// The cost of resuming a coroutine whose frame is on another NUMA node
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Many coroutines, each with about 1KB of state in its frame, are created by
+// a pool thread on one node, so their frames come from that node's arena
+// (numa::node_frames). A thread pinned to the same node, and then one pinned
+// to the node furthest from it in our numbering, resumes them round-robin;
+// each resume updates the whole of the frame's state. There are enough
+// frames that they don't stay in cache, so the difference is remote memory.
+// On a machine with one node both runs are on that node, and should agree.
+// Output is in the format of coro_bench.cpp.
+//
+// usage: numabench [resumes] [frames]
+
+#include <cstdint>
+#include <cstdlib>
+#include <future>
+#include <iostream>
+#include <vector>
+#include <experimental/coroutine>
+
+#include "bench.hpp"
+#include "frame_stats.hpp"
+#include "numa.hpp"
+
+struct toucher {
+    struct promise_type : frame_stats::accounted<promise_type, numa::node_frames> {
+        auto initial_suspend() const noexcept { return std::experimental::suspend_always(); }
+        auto final_suspend() const noexcept { return std::experimental::suspend_always(); }
+        void return_void() const noexcept {}
+        void unhandled_exception() { std::terminate(); }
+        toucher get_return_object() {
+            return toucher(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    explicit toucher(std::experimental::coroutine_handle<promise_type> coro) : coro_(coro) {}
+    toucher(toucher&& other) noexcept : coro_(std::exchange(other.coro_, nullptr)) {}
+    toucher(toucher const&) = delete;
+    ~toucher() {
+        if (coro_) {
+            coro_.destroy();
+        }
+    }
+
+    void resume() { coro_.resume(); }
+
+private:
+    std::experimental::coroutine_handle<promise_type> coro_;
+};
+
+toucher touch_forever() {
+    std::uint64_t state[128] = {};
+    while (true) {
+        for (auto& s : state) {
+            ++s;
+        }
+        co_await std::experimental::suspend_always();
+    }
+}
+
+// run f on one of the node's pool threads, and wait for it
+template<typename F>
+void on_node(node_pools& pools, unsigned node, F f) {
+    std::promise<void> done;
+    pools.pool(node).post([&]() {
+        f();
+        done.set_value();
+    });
+    done.get_future().wait();
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 1000000);
+    std::size_t count = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 16384;
+
+    auto const& topo = numa::topology::get();
+    unsigned home = 0;
+    unsigned far = static_cast<unsigned>(topo.nodes() - 1);
+    if (topo.nodes() == 1) {
+        std::cerr << "only one NUMA node: \"cross_node\" runs on the same node\n";
+    }
+
+    node_pools pools(1);
+    std::vector<toucher> frames;
+    frames.reserve(count);
+    on_node(pools, home, [&]() {
+        for (std::size_t i = 0; i < count; ++i) {
+            frames.push_back(touch_forever());
+            frames.back().resume();     // and touch its pages from here first
+        }
+    });
+
+    auto resume_from = [&](char const* name, unsigned node) {
+        thread_pool::pin_this_thread(topo.node_cpus[node]);
+        bench::report(std::cout, bench::measure(name, n, [&](std::size_t k) {
+                    for (std::size_t i = 0; i < k; ++i) {
+                        frames[i % count].resume();
+                    }
+                }));
+    };
+    resume_from("numa/resume_same_node", home);
+    resume_from("numa/resume_cross_node", far);
+}
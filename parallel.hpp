@@ -0,0 +1,336 @@
+// Data-parallel for_each and transform_reduce on a thread_pool, awaited by a coroutine
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef PARALLEL_HPP
+#define PARALLEL_HPP
+
+// co_await parallel_for_each(pool, first, last, f);
+// auto sum = co_await parallel_transform_reduce(pool, first, last, init, reduce, transform);
+//
+// The range (random access) is cut into chunks of at least `grain` elements,
+// a few per pool thread, and each chunk is one pool task. The awaiting
+// coroutine is resumed, on whichever pool thread finishes last, once all of
+// them are done. Each chunk runs a plain loop over its elements, with f or
+// transform inlined, which the compiler can vectorize; transform_reduce
+// keeps four independent accumulators per chunk so that the additions (or
+// whatever reduce is) are not one long dependency chain. As with
+// std::reduce, reduce must be associative and commutative.
+//
+// For work already split up (a vector of buffers, a generator of chunks...)
+// each overload also takes a range of ranges in place of first and last;
+// the chunks are then split further as needed. They must stay valid until
+// the operation completes.
+//
+// parallel_for_chunks() is the level below: it gives the function each
+// chunk's [first, last), so you can write the loop yourself.
+//
+// If f (or transform, or reduce) throws, chunks not yet started are skipped,
+// and once the rest have finished the first exception is rethrown from the
+// co_await. Any others are dropped.
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <exception>
+#include <iterator>
+#include <optional>
+#include <utility>
+#include <vector>
+#include <experimental/coroutine>
+
+#include "thread_pool.hpp"
+
+namespace detail {
+
+constexpr std::size_t default_grain = 16 * 1024;
+
+// chunks per pool thread, so one slow thread does not hold everyone up
+constexpr std::size_t chunks_per_thread = 4;
+
+// cut [first, last) into pieces and append them to out
+template<typename It>
+void split(It first, It last, std::size_t parts, std::size_t grain, std::vector<std::pair<It, It>>& out) {
+    auto n = static_cast<std::size_t>(std::distance(first, last));
+    if (n == 0) {
+        return;
+    }
+    parts = std::max<std::size_t>(1, std::min(parts, n / std::max<std::size_t>(grain, 1)));
+    auto per = n / parts;
+    auto extra = n % parts;
+    for (std::size_t i = 0; i < parts; ++i) {
+        auto len = static_cast<typename std::iterator_traits<It>::difference_type>(per + (i < extra ? 1 : 0));
+        out.emplace_back(first, first + len);
+        first += len;
+    }
+}
+
+// The chunks of one operation. Kernel::run(index, first, last) does a chunk;
+// Kernel::result() combines whatever they produced.
+template<typename It, typename Kernel>
+struct parallel_awaitable {
+    parallel_awaitable(thread_pool& pool, std::vector<std::pair<It, It>> chunks, Kernel kernel)
+        : pool_(pool), chunks_(std::move(chunks)), kernel_(std::move(kernel)) {
+        kernel_.resize(chunks_.size());
+    }
+
+    parallel_awaitable(parallel_awaitable const&) = delete;
+
+    bool await_ready() {
+        if (chunks_.size() <= 1) {
+            // not worth a trip to the pool
+            if (!chunks_.empty()) {
+                kernel_.run(0, chunks_[0].first, chunks_[0].second);
+            }
+            return true;
+        }
+        return false;
+    }
+
+    void await_suspend(std::experimental::coroutine_handle<> coro) {
+        coro_ = coro;
+        remaining_.store(chunks_.size(), std::memory_order_relaxed);
+        tasks_.reserve(chunks_.size());
+        for (std::size_t i = 0; i < chunks_.size(); ++i) {
+            tasks_.emplace_back(this, i);
+        }
+        for (std::size_t i = 0; i + 1 < tasks_.size(); ++i) {
+            tasks_[i].next_ = &tasks_[i + 1];
+        }
+        // after this, the last chunk to finish may resume the coroutine at any moment
+        pool_.post_list(&tasks_.front(), &tasks_.back(), tasks_.size());
+    }
+
+    decltype(auto) await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return kernel_.result();
+    }
+
+private:
+    struct chunk_task : thread_pool::task {
+        parallel_awaitable* op_;
+        std::size_t index_;
+
+        chunk_task(parallel_awaitable* op, std::size_t index) : task(&run), op_(op), index_(index) {}
+
+        static void run(thread_pool::task* t) {
+            auto self = static_cast<chunk_task*>(t);
+            auto op = self->op_;
+            auto const& chunk = op->chunks_[self->index_];
+            if (!op->failed_.load(std::memory_order_relaxed)) {
+                try {
+                    op->kernel_.run(self->index_, chunk.first, chunk.second);
+                } catch (...) {
+                    if (!op->failed_.exchange(true, std::memory_order_relaxed)) {
+                        op->error_ = std::current_exception();
+                    }
+                }
+            }
+            // a chunk that threw counts as done too; the acq_rel here makes
+            // error_ visible to whoever resumes the coroutine
+            if (op->remaining_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+                op->coro_.resume();
+            }
+        }
+    };
+
+    thread_pool& pool_;
+    std::vector<std::pair<It, It>> chunks_;
+    Kernel kernel_;
+    std::vector<chunk_task> tasks_;
+    std::atomic<std::size_t> remaining_{0};
+    std::experimental::coroutine_handle<> coro_;
+    std::atomic<bool> failed_{false};
+    std::exception_ptr error_;          // the first chunk's exception, set once
+};
+
+template<typename F>
+struct for_chunks_kernel {
+    F f_;
+
+    void resize(std::size_t) {}
+
+    template<typename It>
+    void run(std::size_t, It first, It last) {
+        f_(first, last);
+    }
+
+    void result() const noexcept {}
+};
+
+template<typename F>
+struct for_each_kernel {
+    F f_;
+
+    void resize(std::size_t) {}
+
+    template<typename It>
+    void run(std::size_t, It first, It last) {
+        for (; first != last; ++first) {
+            f_(*first);
+        }
+    }
+
+    void result() const noexcept {}
+};
+
+template<typename T, typename Reduce, typename Transform>
+struct transform_reduce_kernel {
+    T init_;
+    Reduce reduce_;
+    Transform transform_;
+
+    // one per chunk, on its own cache line so the chunks' threads don't collide
+    struct alignas(64) partial {
+        std::optional<T> value;
+    };
+    std::vector<partial> partials_;
+
+    void resize(std::size_t n) {
+        partials_.resize(n);
+    }
+
+    template<typename It>
+    void run(std::size_t index, It first, It last) {
+        auto n = std::distance(first, last);
+        if (n < 4) {
+            T acc = transform_(*first);
+            for (++first; first != last; ++first) {
+                acc = reduce_(std::move(acc), transform_(*first));
+            }
+            partials_[index].value.emplace(std::move(acc));
+            return;
+        }
+        // four independent running results, each seeded with an element
+        T a0 = transform_(first[0]);
+        T a1 = transform_(first[1]);
+        T a2 = transform_(first[2]);
+        T a3 = transform_(first[3]);
+        decltype(n) i = 4;
+        for (; i + 4 <= n; i += 4) {
+            a0 = reduce_(std::move(a0), transform_(first[i]));
+            a1 = reduce_(std::move(a1), transform_(first[i + 1]));
+            a2 = reduce_(std::move(a2), transform_(first[i + 2]));
+            a3 = reduce_(std::move(a3), transform_(first[i + 3]));
+        }
+        for (; i < n; ++i) {
+            a0 = reduce_(std::move(a0), transform_(first[i]));
+        }
+        partials_[index].value.emplace(reduce_(reduce_(std::move(a0), std::move(a1)),
+                                               reduce_(std::move(a2), std::move(a3))));
+    }
+
+    // combined in chunk order, so the result does not depend on timing
+    T result() {
+        T acc = std::move(init_);
+        for (auto& p : partials_) {
+            if (p.value) {
+                acc = reduce_(std::move(acc), std::move(*p.value));
+            }
+        }
+        return acc;
+    }
+};
+
+template<typename It, typename Kernel>
+parallel_awaitable<It, Kernel> make_parallel(thread_pool& pool, It first, It last, std::size_t grain, Kernel k) {
+    std::vector<std::pair<It, It>> chunks;
+    split(first, last, pool.concurrency() * chunks_per_thread, grain, chunks);
+    return parallel_awaitable<It, Kernel>(pool, std::move(chunks), std::move(k));
+}
+
+// for a range of chunks: each is split in proportion to its share of the total
+template<typename Chunks, typename Kernel>
+auto make_parallel_chunked(thread_pool& pool, Chunks&& chunks, std::size_t grain, Kernel k) {
+    using std::begin;
+    using std::end;
+    using It = decltype(begin(*begin(chunks)));
+    std::vector<std::pair<It, It>> bounds;
+    std::size_t total = 0;
+    for (auto&& c : chunks) {
+        bounds.emplace_back(begin(c), end(c));
+        total += static_cast<std::size_t>(std::distance(begin(c), end(c)));
+    }
+    std::vector<std::pair<It, It>> pieces;
+    auto parts = pool.concurrency() * chunks_per_thread;
+    for (auto const& [first, last] : bounds) {
+        auto n = static_cast<std::size_t>(std::distance(first, last));
+        split(first, last, total ? std::max<std::size_t>(1, parts * n / total) : 1, grain, pieces);
+    }
+    return parallel_awaitable<It, Kernel>(pool, std::move(pieces), std::move(k));
+}
+
+}
+
+//
+// Over [first, last)
+//
+
+template<typename It, typename F>
+auto parallel_for_chunks(thread_pool& pool, It first, It last, F f,
+                         std::size_t grain = detail::default_grain) {
+    return detail::make_parallel(pool, first, last, grain, detail::for_chunks_kernel<F>{std::move(f)});
+}
+
+template<typename It, typename F>
+auto parallel_for_each(thread_pool& pool, It first, It last, F f,
+                       std::size_t grain = detail::default_grain) {
+    return detail::make_parallel(pool, first, last, grain, detail::for_each_kernel<F>{std::move(f)});
+}
+
+template<typename It, typename T, typename Reduce, typename Transform>
+auto parallel_transform_reduce(thread_pool& pool, It first, It last, T init, Reduce reduce, Transform transform,
+                               std::size_t grain = detail::default_grain) {
+    return detail::make_parallel(pool, first, last, grain,
+                                 detail::transform_reduce_kernel<T, Reduce, Transform>{
+                                     std::move(init), std::move(reduce), std::move(transform), {}});
+}
+
+//
+// Over a range of chunks
+//
+
+template<typename Chunks, typename F>
+auto parallel_for_chunks(thread_pool& pool, Chunks&& chunks, F f,
+                         std::size_t grain = detail::default_grain) {
+    return detail::make_parallel_chunked(pool, std::forward<Chunks>(chunks), grain,
+                                         detail::for_chunks_kernel<F>{std::move(f)});
+}
+
+template<typename Chunks, typename F>
+auto parallel_for_each(thread_pool& pool, Chunks&& chunks, F f,
+                       std::size_t grain = detail::default_grain) {
+    return detail::make_parallel_chunked(pool, std::forward<Chunks>(chunks), grain,
+                                         detail::for_each_kernel<F>{std::move(f)});
+}
+
+template<typename Chunks, typename T, typename Reduce, typename Transform>
+auto parallel_transform_reduce(thread_pool& pool, Chunks&& chunks, T init, Reduce reduce, Transform transform,
+                               std::size_t grain = detail::default_grain) {
+    return detail::make_parallel_chunked(pool, std::forward<Chunks>(chunks), grain,
+                                         detail::transform_reduce_kernel<T, Reduce, Transform>{
+                                             std::move(init), std::move(reduce), std::move(transform), {}});
+}
+
+#endif // PARALLEL_HPP
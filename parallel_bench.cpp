@@ -0,0 +1,104 @@
+// a*b+c over large arrays on a thread_pool, with the parallel algorithms in parallel.hpp
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// The muladd from the other examples, applied elementwise to arrays
+// (out = a*b+c), and a dot product of a and b, each done serially and with
+// parallel_for_chunks / parallel_for_each / parallel_transform_reduce, each
+// awaited through sync_wait. muladd moves 16 bytes per element, so at large sizes it is
+// limited by memory bandwidth: bytes_per_op here is allocations, as elsewhere,
+// but ns_per_op is per element.
+// Output is in the format of coro_bench.cpp.
+//
+// usage: pbench [elements] [threads]
+
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <vector>
+
+#include "bench.hpp"
+#include "parallel.hpp"
+#include "sync_wait.hpp"
+#include "thread_pool.hpp"
+
+namespace detail {
+static volatile double sink = 0;
+}
+
+// the leaf kernel: a loop the compiler vectorizes
+inline void muladd(float const* a, float const* b, float const* c, float* out, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        out[i] = a[i] * b[i] + c[i];
+    }
+}
+
+struct arrays {
+    explicit arrays(std::size_t n) : a(n, 2.0f), b(n, 3.0f), c(n, 4.0f), out(n) {}
+    std::vector<float> a, b, c, out;
+};
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 1 << 24);
+    thread_pool pool(argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 0);
+    arrays v(n);
+
+    bench::report(std::cout, bench::measure("muladd/serial", n, [&](std::size_t k) {
+                muladd(v.a.data(), v.b.data(), v.c.data(), v.out.data(), k);
+            }));
+    float* out = v.out.data();
+    float const* a = v.a.data();
+    float const* b = v.b.data();
+    float const* c = v.c.data();
+    bench::report(std::cout, bench::measure("muladd/parallel_for_chunks", n, [&](std::size_t k) {
+                sync_wait(parallel_for_chunks(pool, out, out + k, [=](float* first, float* last) {
+                        auto i = first - out;
+                        muladd(a + i, b + i, c + i, first, static_cast<std::size_t>(last - first));
+                    }));
+            }));
+    bench::report(std::cout, bench::measure("muladd/parallel_for_each", n, [&](std::size_t k) {
+                sync_wait(parallel_for_each(pool, out, out + k, [=](float& o) {
+                        auto i = &o - out;
+                        o = a[i] * b[i] + c[i];
+                    }));
+            }));
+
+    bench::report(std::cout, bench::measure("dot/serial", n, [&](std::size_t k) {
+                detail::sink = std::inner_product(v.a.begin(), v.a.begin() + k, v.b.begin(), 0.0);
+            }));
+    bench::report(std::cout, bench::measure("dot/parallel_transform_reduce", n, [&](std::size_t k) {
+                detail::sink = sync_wait(parallel_transform_reduce(pool, a, a + k, 0.0, std::plus<>(),
+                                                                   [a, b](float const& x) { return double(x) * b[&x - a]; }));
+            }));
+
+    // the same work already split up: 64 separately allocated pieces
+    std::vector<std::vector<float>> pieces(64, std::vector<float>(n / 64, 1.0f));
+    bench::report(std::cout, bench::measure("sum/parallel_transform_reduce_pieces", (n / 64) * 64, [&](std::size_t) {
+                detail::sink = sync_wait(parallel_transform_reduce(pool, pieces, 0.0, std::plus<>(),
+                                                                   [](float x) { return double(x); }));
+            }));
+    if (detail::sink != static_cast<double>((n / 64) * 64)) {
+        std::cerr << "wrong sum " << detail::sink << "\n";
+        return 1;
+    }
+}
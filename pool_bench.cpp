@@ -0,0 +1,139 @@
+// Fixed and elastic thread_pools under work that sometimes blocks
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Most tasks spin for about a microsecond; one in blocking_every sleeps,
+// standing in for a blocking system call. A fixed pool loses a thread for
+// each sleeper; an elastic one notices (or is told, via blocking_scope) and
+// adds threads while the sleepers hold theirs.
+// ns_per_op is per task, from posting the first to finishing the last.
+// Output is in the format of coro_bench.cpp.
+//
+// usage: poolbench [tasks] [threads]
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdlib>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "bench.hpp"
+#include "thread_pool.hpp"
+
+constexpr std::size_t blocking_every = 64;
+constexpr auto blocking_time = std::chrono::milliseconds(2);
+
+// the tasks of one run, and a way to wait for all of them
+struct batch {
+    struct job : thread_pool::task {
+        batch* batch_;
+        std::size_t index_;
+
+        job(batch* b, std::size_t i) : task(&run), batch_(b), index_(i) {}
+
+        static void run(thread_pool::task* t) {
+            auto self = static_cast<job*>(t);
+            self->batch_->work(self->index_);
+        }
+    };
+
+    batch(std::size_t n, bool declare) : remaining_(n), declare_(declare) {
+        jobs_.reserve(n);
+        for (std::size_t i = 0; i < n; ++i) {
+            jobs_.emplace_back(this, i);
+        }
+        for (std::size_t i = 0; i + 1 < n; ++i) {
+            jobs_[i].next_ = &jobs_[i + 1];
+        }
+    }
+
+    void run(thread_pool& pool) {
+        pool.post_list(&jobs_.front(), &jobs_.back(), jobs_.size());
+        std::unique_lock<std::mutex> lock(mutex_);
+        done_.wait(lock, [this]() { return remaining_ == 0; });
+    }
+
+private:
+    void work(std::size_t i) {
+        if (i % blocking_every == blocking_every - 1) {
+            if (declare_) {
+                thread_pool::blocking_scope blocking;
+                std::this_thread::sleep_for(blocking_time);
+            } else {
+                std::this_thread::sleep_for(blocking_time);
+            }
+        } else {
+            spin();
+        }
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (--remaining_ == 0) {
+            done_.notify_all();
+        }
+    }
+
+    static void spin() {
+        auto until = std::chrono::steady_clock::now() + std::chrono::microseconds(1);
+        while (std::chrono::steady_clock::now() < until) {
+        }
+    }
+
+    std::vector<job> jobs_;
+    std::mutex mutex_;
+    std::condition_variable done_;
+    std::size_t remaining_;
+    bool declare_;
+};
+
+void measure(std::string name, thread_pool& pool, std::size_t n, bool declare) {
+    bench::report(std::cout, bench::measure(std::move(name), n, [&](std::size_t k) {
+                batch b(k, declare);
+                b.run(pool);
+            }));
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 20000);
+    std::size_t threads = argc > 2 ? std::strtoull(argv[2], nullptr, 10) : 4;
+
+    {
+        thread_pool pool(threads);
+        measure("pool/fixed", pool, n, false);
+    }
+
+    thread_pool::elastic options;
+    options.min_threads = 1;
+    options.max_threads = threads;
+    options.target_wait = std::chrono::microseconds(500);
+    options.blocked_after = std::chrono::milliseconds(1);
+    {
+        thread_pool pool(options);
+        measure("pool/elastic", pool, n, false);
+    }
+    {
+        thread_pool pool(options);
+        measure("pool/elastic_declared_blocking", pool, n, true);
+    }
+}
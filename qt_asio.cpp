@@ -0,0 +1,142 @@
+// Implementation of qt_asio_driver
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "qt_asio.hpp"
+
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <QAbstractEventDispatcher>
+#include <QEvent>
+
+#include <boost/asio/detail/reactor.hpp>
+
+#if !defined(BOOST_ASIO_HAS_EPOLL)
+#error "qt_asio_driver needs Asio's epoll reactor"
+#endif
+
+namespace {
+
+// Asio has no public way to get at the reactor's epoll descriptor, so we use
+// the rule that explicit instantiations may name private members: the
+// instantiation below defines a friend function returning a pointer to it.
+// If a future Asio renames the member this stops compiling rather than
+// misbehaving.
+struct reactor_fd_tag {
+    using type = int boost::asio::detail::epoll_reactor::*;
+    friend type member(reactor_fd_tag);
+};
+
+template<typename Tag, typename Tag::type Member>
+struct expose {
+    friend typename Tag::type member(Tag) { return Member; }
+};
+
+template struct expose<reactor_fd_tag, &boost::asio::detail::epoll_reactor::epoll_fd_>;
+
+int reactor_fd(boost::asio::io_context& io) {
+    // creates the reactor if nothing has needed it yet
+    auto& reactor = boost::asio::use_service<boost::asio::detail::epoll_reactor>(io);
+    return reactor.*member(reactor_fd_tag{});
+}
+
+// a read notifier that calls a function. We take the notification event
+// directly because QSocketNotifier::activated is overloaded (with private
+// signal tags) in Qt 5.15, so it can't be named portably in connect()
+template<typename F>
+struct fd_notifier : QSocketNotifier {
+    fd_notifier(int fd, F f) : QSocketNotifier(fd, QSocketNotifier::Read), f_(std::move(f)) {}
+
+    bool event(QEvent * e) override {
+        if (e->type() == QEvent::SockAct) {
+            f_();
+            return true;
+        }
+        return QSocketNotifier::event(e);
+    }
+
+private:
+    F f_;
+};
+
+template<typename F>
+std::unique_ptr<QSocketNotifier> make_notifier(int fd, F f) {
+    return std::make_unique<fd_notifier<F>>(fd, std::move(f));
+}
+
+}
+
+qt_asio_driver::qt_asio_driver(boost::asio::io_context& io, run_queue* rq)
+    : io_(io), rq_(rq), work_(io.get_executor()),
+      wake_fd_(::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC)) {
+    if (wake_fd_ < 0) {
+        throw std::runtime_error("eventfd failed");
+    }
+
+    reactor_notifier_ = make_notifier(reactor_fd(io_), [this]() { drive(); });
+    wake_notifier_ = make_notifier(wake_fd_, [this]() {
+        std::uint64_t count;
+        [[maybe_unused]] auto n = ::read(wake_fd_, &count, sizeof(count));
+        drive();
+    });
+
+    // catch work queued by this thread since we last looked. If nothing is
+    // ready this costs one epoll_wait with a zero timeout per pass of the loop
+    about_to_block_ = QObject::connect(QAbstractEventDispatcher::instance(),
+                                       &QAbstractEventDispatcher::aboutToBlock,
+                                       wake_notifier_.get(), [this]() { drive(); });
+}
+
+qt_asio_driver::~qt_asio_driver() {
+    QObject::disconnect(about_to_block_);
+    reactor_notifier_.reset();
+    wake_notifier_.reset();
+    ::close(wake_fd_);
+}
+
+void qt_asio_driver::wake() noexcept {
+    std::uint64_t one = 1;
+    [[maybe_unused]] auto n = ::write(wake_fd_, &one, sizeof(one));
+}
+
+void qt_asio_driver::drive() {
+    // each side can queue work for the other, so go back and forth until both are done
+    for (int pass = 0; pass < max_passes; ++pass) {
+        bool busy = io_.poll() != 0;
+        // only what's queued now, so a task that keeps requeueing itself
+        // can't hold us here past max_passes
+        if (rq_ && rq_->run_available() != 0) {
+            busy = true;
+        }
+        if (!busy) {
+            return;
+        }
+    }
+    // still going: let Qt process its events, then come back
+    wake();
+}
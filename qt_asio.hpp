@@ -0,0 +1,83 @@
+// Driving Asio and run_queue from the Qt event loop, on its thread
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef QT_ASIO_HPP
+#define QT_ASIO_HPP
+
+// qt_asio_driver runs an io_context's handlers and a run_queue's tasks on the
+// Qt event loop's thread, so Asio awaitables, run_queue coroutines, and
+// qtcoro coroutines can all share data without locks or thread hops.
+// Nothing polls on a timer. The loop sleeps until one of these happens:
+// - a socket, timer, or other descriptor Asio is waiting on becomes ready.
+//   Qt watches Asio's own epoll descriptor with a QSocketNotifier; it is
+//   readable exactly when Asio has I/O or a timer to complete.
+// - work was queued from this thread (a post, or a run_queue task added by a
+//   Qt slot). We run that just before Qt's event loop goes to sleep.
+// - another thread calls wake(), which writes to an eventfd that Qt also watches.
+// Each time, we alternate io_context::poll() and run_queue::run_available()
+// until both are idle, or until a limit so that Qt's own events (painting!)
+// get a turn. run_available() leaves tasks queued by tasks for the next pass.
+//
+// Linux only (epoll and eventfd). Create the driver after the Qt application
+// object. Handlers run on the Qt thread, so io_context::run() must not also
+// be called elsewhere; an io_context made with concurrency hint 1 skips
+// some locking, as in io_context_pool.hpp.
+
+#include <memory>
+
+#include <QSocketNotifier>
+
+#include <boost/asio/executor_work_guard.hpp>
+#include <boost/asio/io_context.hpp>
+
+#include "run_queue.hpp"
+
+struct qt_asio_driver {
+    // the run_queue is optional
+    explicit qt_asio_driver(boost::asio::io_context& io, run_queue* rq = nullptr);
+    ~qt_asio_driver();
+
+    qt_asio_driver(qt_asio_driver const&) = delete;
+    qt_asio_driver& operator=(qt_asio_driver const&) = delete;
+
+    // from any thread: make the Qt thread look for work soon, e.g. after
+    // posting to the io_context from a thread pool
+    void wake() noexcept;
+
+private:
+    void drive();
+
+    // passes of poll() and run() per wakeup before yielding to Qt
+    static constexpr int max_passes = 16;
+
+    boost::asio::io_context& io_;
+    run_queue* rq_;
+    // poll() would otherwise stop the io_context whenever it runs out of work
+    boost::asio::executor_work_guard<boost::asio::io_context::executor_type> work_;
+    int wake_fd_;
+    std::unique_ptr<QSocketNotifier> reactor_notifier_;
+    std::unique_ptr<QSocketNotifier> wake_notifier_;
+    QMetaObject::Connection about_to_block_;
+};
+
+#endif // QT_ASIO_HPP
@@ -0,0 +1,104 @@
+// Asio, run_queue, and Qt coroutines together on the Qt event loop's thread
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// qt_coro.cpp again, but with the color changes timed by an Asio coroutine,
+// lines drawn after an Asio timer awaited from a qtcoro coroutine, and line
+// reports printed by run_queue tasks. qt_asio_driver runs all of it on the
+// GUI thread, so everything can touch the widget directly.
+
+#include <chrono>
+#include <iostream>
+
+#include <QApplication>
+
+#include <experimental/coroutine>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+
+#include "asio_bridge.hpp"
+#include "colorrect.h"
+#include "qt_asio.hpp"
+#include "qtcoro.hpp"
+#include "run_queue.hpp"
+
+using namespace std::chrono_literals;
+using boost::asio::awaitable;
+using boost::asio::use_awaitable;
+
+// an Asio coroutine: change widget color every 500ms
+awaitable<void> cycle_colors(ColorRect & cr) {
+    boost::asio::steady_timer timer(co_await boost::asio::this_coro::executor);
+    while (true) {
+        timer.expires_after(500ms);
+        co_await timer.async_wait(use_awaitable);
+        cr.changeColor();
+    }
+}
+
+// a qtcoro coroutine: draw lines from clicks, pausing a moment on an Asio timer
+qtcoro::return_object<> draw_lines(ColorRect & cr, boost::asio::io_context & io) {
+    auto clicks = qtcoro::make_signal_stream(&cr, &ColorRect::click);
+    boost::asio::steady_timer delay(io);
+    while (true) {
+        QPointF first_point = co_await clicks.next();
+        QPointF second_point = co_await clicks.next();
+        delay.expires_after(250ms);
+        co_await delay.async_wait(use_resume);
+        cr.addLine(first_point, second_point);
+    }
+}
+
+// and report each line from a run_queue task
+qtcoro::return_object<> report_lines(ColorRect & cr, run_queue & rq) {
+    auto lines = qtcoro::make_signal_stream(&cr, &ColorRect::lineCreated);
+    while (true) {
+        auto [p1, p2] = co_await lines.next();
+        rq.add_task([p1 = p1, p2 = p2](run_queue*) {
+            std::cout << "we drew a line from (";
+            std::cout << p1.x() << ", " << p1.y() << ") to (";
+            std::cout << p2.x() << ", " << p2.y() << ")\n";
+        });
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    QApplication app(argc, argv);
+
+    ColorRect cr;
+    cr.setWindowTitle("Color Cycler");
+    cr.show();
+
+    boost::asio::io_context io(1);
+    run_queue rq;
+    qt_asio_driver driver(io, &rq);
+
+    boost::asio::co_spawn(io, cycle_colors(cr), boost::asio::detached);
+    auto lines_ro = draw_lines(cr, io);
+    auto report_ro = report_lines(cr, rq);
+
+    return app.exec();
+}
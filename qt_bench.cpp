@@ -0,0 +1,175 @@
+// Signal delivery to plain slots vs. coroutines, without a display
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// For signals of zero, one, and two arguments, over direct and queued
+// connections, compares
+//   slot:   a lambda connected once, as in qt_basic.cpp
+//   await:  co_await on make_awaitable_signal in a loop, as in qt_coro.cpp,
+//           which connects and disconnects for every emission (direct only,
+//           since awaitable_signal has no connection type)
+//   stream: co_await on a signal_stream, connected once
+// Output is in the format of coro_bench.cpp; each op is one emission
+// delivered. Allocations are those made through operator new; Qt's
+// malloc-based containers aren't counted.
+// Only QCoreApplication is used, so no display or platform plugin is needed.
+//
+// usage: qbench [emissions]
+
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <type_traits>
+
+#include <QCoreApplication>
+
+#include "bench.hpp"
+#include "emitter.h"
+#include "qtcoro.hpp"
+
+namespace detail {
+// somewhere to put results so the optimizer can't discard the work
+static volatile int sink = 0;
+
+void consume(int x) { sink = x; }
+void consume(std::tuple<int, QPointF> const& t) { sink = std::get<0>(t) + static_cast<int>(std::get<1>(t).x()); }
+}
+
+// queued emissions are delivered in batches, as an event loop would
+constexpr std::size_t queued_batch = 1024;
+
+// the signals under test, by number of arguments
+template<int Arity>
+auto signal_of() {
+    if constexpr (Arity == 0) {
+        return &Emitter::zero;
+    } else if constexpr (Arity == 1) {
+        return &Emitter::one;
+    } else {
+        return &Emitter::two;
+    }
+}
+
+template<int Arity>
+void fire(Emitter& e, std::size_t i) {
+    if constexpr (Arity == 0) {
+        emit e.zero();
+    } else if constexpr (Arity == 1) {
+        emit e.one(static_cast<int>(i));
+    } else {
+        emit e.two(static_cast<int>(i), QPointF(static_cast<double>(i), 0.0));
+    }
+}
+
+// emit n times, draining posted events as we go if the connection is queued
+template<int Arity>
+void fire_n(Emitter& e, std::size_t n, Qt::ConnectionType type) {
+    for (std::size_t i = 0; i < n; ++i) {
+        fire<Arity>(e, i);
+        if (type == Qt::QueuedConnection && (i + 1) % queued_batch == 0) {
+            QCoreApplication::sendPostedEvents();
+        }
+    }
+    QCoreApplication::sendPostedEvents();
+}
+
+//
+// the styles
+//
+
+template<int Arity>
+void slot_style(Emitter& e, std::size_t n, Qt::ConnectionType type) {
+    QMetaObject::Connection conn;
+    if constexpr (Arity == 0) {
+        conn = QObject::connect(&e, &Emitter::zero, &e, []() { detail::sink = 0; }, type);
+    } else if constexpr (Arity == 1) {
+        conn = QObject::connect(&e, &Emitter::one, &e, [](int x) { detail::consume(x); }, type);
+    } else {
+        conn = QObject::connect(&e, &Emitter::two, &e,
+                                [](int x, QPointF p) { detail::consume(std::make_tuple(x, p)); }, type);
+    }
+    fire_n<Arity>(e, n, type);
+    QObject::disconnect(conn);
+}
+
+// the loops end after n emissions; an awaitable_signal left waiting would
+// stay connected after its coroutine was destroyed
+template<int Arity>
+qtcoro::return_object<> await_loop(Emitter& e, std::size_t n) {
+    for (std::size_t i = 0; i < n; ++i) {
+        if constexpr (Arity == 0) {
+            co_await qtcoro::make_awaitable_signal(&e, signal_of<Arity>());
+        } else {
+            detail::consume(co_await qtcoro::make_awaitable_signal(&e, signal_of<Arity>()));
+        }
+    }
+}
+
+template<int Arity>
+void await_style(Emitter& e, std::size_t n, Qt::ConnectionType type) {
+    auto coro = await_loop<Arity>(e, n);
+    fire_n<Arity>(e, n, type);
+}
+
+template<int Arity>
+qtcoro::return_object<> stream_loop(Emitter& e, Qt::ConnectionType type, std::size_t n) {
+    auto stream = qtcoro::make_signal_stream(&e, signal_of<Arity>(), type);
+    for (std::size_t i = 0; i < n; ++i) {
+        if constexpr (Arity == 0) {
+            co_await stream.next();
+        } else {
+            detail::consume(co_await stream.next());
+        }
+    }
+}
+
+template<int Arity>
+void stream_style(Emitter& e, std::size_t n, Qt::ConnectionType type) {
+    auto coro = stream_loop<Arity>(e, type, n);
+    fire_n<Arity>(e, n, type);
+}
+
+template<int Arity>
+void run_all(Emitter& e, std::size_t n) {
+    std::string args = std::to_string(Arity);
+    for (auto type : {Qt::DirectConnection, Qt::QueuedConnection}) {
+        std::string conn = type == Qt::DirectConnection ? "/direct/" : "/queued/";
+        bench::report(std::cout, bench::measure("qt/slot" + conn + args, n,
+                                                [&](std::size_t k) { slot_style<Arity>(e, k, type); }));
+        if (type == Qt::DirectConnection) {
+            bench::report(std::cout, bench::measure("qt/await" + conn + args, n,
+                                                    [&](std::size_t k) { await_style<Arity>(e, k, type); }));
+        }
+        bench::report(std::cout, bench::measure("qt/stream" + conn + args, n,
+                                                [&](std::size_t k) { stream_style<Arity>(e, k, type); }));
+    }
+}
+
+int main(int argc, char** argv) {
+    QCoreApplication app(argc, argv);
+    std::size_t n = bench::iterations(argc, argv, 1000000);
+
+    Emitter e;
+    run_all<0>(e, n);
+    run_all<1>(e, n);
+    run_all<2>(e, n);
+}
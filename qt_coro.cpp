@@ -22,6 +22,8 @@ OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
 SOFTWARE.
 */
 
+#include <cmath>
+
 #include <QApplication>
 #include <QTimer>
 
@@ -39,9 +41,12 @@ int main(int argc, char *argv[])
 
     // change widget color every 500ms
     QTimer * changeTimer = new QTimer(&app);
+    // each loop connects to its signal once, through a stream, so emissions
+    // that arrive while the loop body runs are queued rather than lost
     auto ro = [&]() -> qtcoro::return_object<> {
+        auto ticks = qtcoro::make_signal_stream(changeTimer, &QTimer::timeout);
         while (true) {
-            co_await qtcoro::make_awaitable_signal(changeTimer, &QTimer::timeout);
+            co_await ticks.next();
             cr.changeColor();
         }
     }();
@@ -50,20 +55,29 @@ int main(int argc, char *argv[])
 
     // draw lines from clicks
     auto ptclick_ro = [&]() -> qtcoro::return_object<> {
+        auto clicks = qtcoro::make_signal_stream(&cr, &ColorRect::click);
         while (true) {
-            QPointF first_point = co_await qtcoro::make_awaitable_signal(&cr, &ColorRect::click);
-            QPointF second_point = co_await qtcoro::make_awaitable_signal(&cr, &ColorRect::click);
-            cr.setLine(first_point, second_point);
+            QPointF first_point = co_await clicks.next();
+            QPointF second_point = co_await clicks.next();
+            cr.addLine(first_point, second_point);
         }
     }();
 
     // listen for line creation (tests the tuple code)
     auto line_ro = [&]() -> qtcoro::return_object<> {
+        auto lines = qtcoro::make_signal_stream(&cr, &ColorRect::lineCreated);
         while (true) {
-            auto [p1, p2] = co_await qtcoro::make_awaitable_signal(&cr, &ColorRect::lineCreated);
+            auto [p1, p2] = co_await lines.next();
             std::cout << "we drew a line from (";
             std::cout << p1.x() << ", " << p1.y() << ") to (";
             std::cout << p2.x() << ", " << p2.y() << ")\n";
+
+            // anything slow goes to the thread pool so the window keeps painting;
+            // we come back to this (the GUI) thread with the answer
+            double length = co_await qtcoro::run_in_pool(&cr, [p1 = p1, p2 = p2]() {
+                return std::hypot(p2.x() - p1.x(), p2.y() - p1.y());
+            });
+            std::cout << "its length is " << length << "\n";
         }
     }();
 
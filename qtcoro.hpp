@@ -26,10 +26,24 @@ SOFTWARE.
 #ifndef QTCORO_HPP
 #define QTCORO_HPP
 
+#include <array>
+#include <cstddef>
+#include <exception>
 #include <iostream>
+#include <optional>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <variant>
+#include <vector>
 #include <experimental/coroutine>
 #include <QObject>
+#include <QRunnable>
+#include <QThreadPool>
+#include <QTimer>
 
+#include "coro_trace.hpp"
+#include "frame_stats.hpp"
 #include "meta.hpp"
 
 namespace qtcoro {
@@ -73,7 +87,8 @@ struct return_object {
     };
 #endif // INTERNAL_VOID_SPECIALIZATION
 
-    struct promise_type : promise_base<T> {
+    struct promise_type : promise_base<T>, coro_trace::promise_hooks<promise_type>,
+                          frame_stats::accounted<promise_type> {
         // coroutine promise requirements:
 
         auto initial_suspend() const noexcept {
@@ -81,6 +96,7 @@ struct return_object {
         }
 
         auto final_suspend() const noexcept {
+            this->trace_final();
             return std::experimental::suspend_always(); // ?? not sure
         }
 
@@ -88,6 +104,7 @@ struct return_object {
         // we inherit it from promise_base
 
         return_object get_return_object() {
+            this->trace_create(*this);
             return return_object(*this);
         }
 
@@ -261,6 +278,586 @@ make_awaitable_signal(T * t, F fn) {
     return awaitable_signal<F>{t, fn};
 }
 
+//
+// Multi-shot version
+// An awaitable_signal connects when created and disconnects when the signal
+// arrives, so a loop of co_awaits pays for a connect/disconnect pair per
+// iteration and misses anything emitted while it was busy elsewhere.
+// A signal_stream connects once and queues every emission until it is
+// consumed with co_await stream.next().
+//
+
+namespace detail {
+
+// a FIFO that keeps its storage, so once it has grown to the largest
+// backlog seen, pushing and popping don't allocate
+template<typename T>
+struct ring_queue {
+    bool empty() const noexcept { return size_ == 0; }
+    std::size_t size() const noexcept { return size_; }
+
+    void push(T v) {
+        if (size_ == buf_.size()) {
+            grow();
+        }
+        buf_[(head_ + size_) % buf_.size()] = std::move(v);
+        ++size_;
+    }
+
+    T pop() {
+        T v = std::move(buf_[head_]);
+        head_ = (head_ + 1) % buf_.size();
+        --size_;
+        return v;
+    }
+
+private:
+    void grow() {
+        std::vector<T> bigger(buf_.empty() ? 4 : 2 * buf_.size());
+        for (std::size_t i = 0; i < size_; ++i) {
+            bigger[i] = std::move(buf_[(head_ + i) % buf_.size()]);
+        }
+        buf_.swap(bigger);
+        head_ = 0;
+    }
+
+    std::vector<T> buf_;
+    std::size_t head_ = 0;
+    std::size_t size_ = 0;
+};
+
+// queued emissions: the values to hand to co_await
+template<typename Result>
+struct stream_buffer {
+    bool empty() const noexcept { return queue_.empty(); }
+    std::size_t size() const noexcept { return queue_.size(); }
+
+    template<typename... Args>
+    void push(Args const&... a) { queue_.push(Result(a...)); }
+
+    Result pop() { return queue_.pop(); }
+
+private:
+    ring_queue<Result> queue_;
+};
+
+// nullary signals have nothing to store, so just count them
+template<>
+struct stream_buffer<void> {
+    bool empty() const noexcept { return count_ == 0; }
+    std::size_t size() const noexcept { return count_; }
+
+    void push() noexcept { ++count_; }
+
+    void pop() noexcept { --count_; }
+
+private:
+    std::size_t count_ = 0;
+};
+
+}
+
+template<typename Signal, typename Result = typename signal_args_t<Signal>::type>
+struct signal_stream {
+    using obj_t    = typename member_fn_t<Signal>::cls_t;
+
+    // The connection type is passed through to connect(). The slot belongs
+    // to an object of ours, made in the thread that makes the stream (the
+    // consuming coroutine's), so with the default AutoConnection a signal
+    // emitted from another thread is queued to this one, and the buffer and
+    // the waiting coroutine are only ever touched here. A DirectConnection
+    // across threads would defeat that; don't.
+    signal_stream(obj_t * src, Signal method,
+                  Qt::ConnectionType type = Qt::AutoConnection) {
+        // the slot takes the signal's parameters minus any QPrivateSignal
+        using slot_args_t = typename signal_args_t<Signal>::no_empty_t;
+        signal_conn_ = connect_slot(src, method, type, static_cast<slot_args_t*>(nullptr));
+    }
+
+    // the slot refers to us, so we stay put
+    signal_stream(signal_stream const&) = delete;
+    signal_stream& operator=(signal_stream const&) = delete;
+
+    ~signal_stream() {
+        QObject::disconnect(signal_conn_);
+    }
+
+    struct awaiter {
+        awaiter(signal_stream * stream) : stream_(stream) {}
+
+        bool await_ready() const noexcept {
+            return !stream_->buffer_.empty();     // already emitted, no need to suspend
+        }
+
+        template<typename P>
+        void await_suspend(std::experimental::coroutine_handle<P> handle) noexcept {
+            stream_->coro_handle_ = handle;
+        }
+
+        Result await_resume() {
+            return stream_->buffer_.pop();
+        }
+
+    private:
+        signal_stream* stream_;
+    };
+
+    // the oldest emission not yet consumed, waiting for one if necessary
+    awaiter next() { return awaiter{this}; }
+
+    // emissions received but not yet consumed
+    std::size_t pending() const noexcept { return buffer_.size(); }
+
+private:
+    template<typename... Args>
+    QMetaObject::Connection connect_slot(obj_t * src, Signal method, Qt::ConnectionType type,
+                                         std::tuple<Args...>*) {
+        return QObject::connect(src, method, &context_,
+                                [this](Args... a) { deliver(a...); },
+                                type);
+    }
+
+    template<typename... Args>
+    void deliver(Args const&... a) {
+        buffer_.push(a...);
+        if (coro_handle_) {
+            // someone is waiting: resume them, leaving no handle behind in case
+            // they come straight back to next()
+            auto handle = coro_handle_;
+            coro_handle_ = nullptr;
+            handle.resume();
+        }
+    }
+
+    QObject context_;       // lives in the consuming thread; our slot runs there
+    detail::stream_buffer<Result> buffer_;
+    QMetaObject::Connection signal_conn_;
+    std::experimental::coroutine_handle<> coro_handle_;
+};
+
+// returned by value; relies on guaranteed copy elision since the stream can't move
+template<typename T, typename F>
+signal_stream<F>
+make_signal_stream(T * t, F fn, Qt::ConnectionType type = Qt::AutoConnection) {
+    return signal_stream<F>{t, fn, type};
+}
+
+//
+// Coalescing versions, for signals that come in storms (mouse moves, say)
+// where only the newest value matters. Like signal_stream these connect once,
+// but keep just the latest emission and hand it over at a limited rate:
+//   latest:   once per interval, at the end of it; an interval of 0 means
+//             once per pass of the event loop
+//   throttle: right away if we have been quiet for an interval, otherwise at
+//             the end of it; so at most once per interval, but without delay
+//             for isolated emissions
+//   debounce: only once emissions have stopped for an interval
+// Either way the coroutine is resumed at the display rate (or less) rather
+// than at the signal rate, and anything it repaints is repainted that often.
+//
+
+enum class coalesce { latest, throttle, debounce };
+
+namespace detail {
+
+// the newest emission not yet consumed, if any
+template<typename Result>
+struct latest_value {
+    bool has_value() const noexcept { return value_.has_value(); }
+
+    template<typename... Args>
+    void store(Args const&... a) { value_.emplace(a...); }
+
+    Result take() {
+        Result r = std::move(*value_);
+        value_.reset();
+        return r;
+    }
+
+private:
+    std::optional<Result> value_;
+};
+
+template<>
+struct latest_value<void> {
+    bool has_value() const noexcept { return emitted_; }
+
+    void store() noexcept { emitted_ = true; }
+
+    void take() noexcept { emitted_ = false; }
+
+private:
+    bool emitted_ = false;
+};
+
+}
+
+template<typename Signal, typename Result = typename signal_args_t<Signal>::type>
+struct coalesced_signal {
+    using obj_t    = typename member_fn_t<Signal>::cls_t;
+
+    coalesced_signal(obj_t * src, Signal method, coalesce mode, int msec)
+        : mode_(mode), interval_(msec) {
+        timer_.setSingleShot(true);
+        timer_conn_ = QObject::connect(&timer_, &QTimer::timeout, &timer_,
+                                       [this]() { interval_over(); });
+        using slot_args_t = typename signal_args_t<Signal>::no_empty_t;
+        signal_conn_ = connect_slot(src, method, static_cast<slot_args_t*>(nullptr));
+    }
+
+    // the slots refer to us, so we stay put
+    coalesced_signal(coalesced_signal const&) = delete;
+    coalesced_signal& operator=(coalesced_signal const&) = delete;
+
+    ~coalesced_signal() {
+        QObject::disconnect(signal_conn_);
+        QObject::disconnect(timer_conn_);
+    }
+
+    struct awaiter {
+        awaiter(coalesced_signal * sig) : sig_(sig) {}
+
+        bool await_ready() const noexcept {
+            return sig_->ready_;
+        }
+
+        template<typename P>
+        void await_suspend(std::experimental::coroutine_handle<P> handle) noexcept {
+            sig_->coro_handle_ = handle;
+        }
+
+        Result await_resume() {
+            sig_->ready_ = false;
+            return sig_->latest_.take();
+        }
+
+    private:
+        coalesced_signal* sig_;
+    };
+
+    // the newest emission, once the mode allows it to be delivered
+    awaiter next() { return awaiter{this}; }
+
+private:
+    template<typename... Args>
+    QMetaObject::Connection connect_slot(obj_t * src, Signal method, std::tuple<Args...>*) {
+        // the timer is ours, in the consuming thread, so the slot runs there too
+        return QObject::connect(src, method, &timer_, [this](Args... a) { emitted(a...); });
+    }
+
+    template<typename... Args>
+    void emitted(Args const&... a) {
+        latest_.store(a...);
+        switch (mode_) {
+        case coalesce::latest:
+            if (!timer_.isActive()) {
+                timer_.start(interval_);
+            }
+            break;
+        case coalesce::throttle:
+            if (!timer_.isActive()) {
+                // quiet until now: deliver immediately, then hold off for an interval
+                timer_.start(interval_);
+                deliver();
+            }
+            break;
+        case coalesce::debounce:
+            timer_.start(interval_);    // restarts the wait
+            break;
+        }
+    }
+
+    void interval_over() {
+        if (!latest_.has_value()) {
+            return;     // throttling, and nothing arrived since the last delivery
+        }
+        if (mode_ == coalesce::throttle) {
+            timer_.start(interval_);    // this delivery starts another interval
+        }
+        deliver();
+    }
+
+    void deliver() {
+        ready_ = true;
+        if (coro_handle_) {
+            auto handle = coro_handle_;
+            coro_handle_ = nullptr;
+            handle.resume();
+        }
+    }
+
+    coalesce mode_;
+    int interval_;
+    QTimer timer_;
+    detail::latest_value<Result> latest_;
+    bool ready_ = false;
+    QMetaObject::Connection signal_conn_;
+    QMetaObject::Connection timer_conn_;
+    std::experimental::coroutine_handle<> coro_handle_;
+};
+
+template<typename T, typename F>
+coalesced_signal<F>
+make_latest_signal(T * t, F fn, int msec = 0) {
+    return coalesced_signal<F>{t, fn, coalesce::latest, msec};
+}
+
+template<typename T, typename F>
+coalesced_signal<F>
+make_throttled_signal(T * t, F fn, int msec) {
+    return coalesced_signal<F>{t, fn, coalesce::throttle, msec};
+}
+
+template<typename T, typename F>
+coalesced_signal<F>
+make_debounced_signal(T * t, F fn, int msec) {
+    return coalesced_signal<F>{t, fn, coalesce::debounce, msec};
+}
+
+//
+// Waiting for the first of several signals, or a timeout
+// auto r = co_await qtcoro::when_any(qtcoro::on(reply, &Reply::finished),
+//                                    qtcoro::on(reply, &Reply::error),
+//                                    5000);      // optional timeout in ms
+// gives a std::variant whose index() says which signal came first (or, for
+// the last index, that the time ran out) and whose value is that signal's
+// arguments as awaitable_signal would return them (std::monostate for none).
+// Everything is connected when the coroutine suspends, and the moment one of
+// them fires all the rest are disconnected, so nothing outlives the co_await.
+// The slots run in the awaiting thread, even for signals from objects in
+// other threads, so that is where the coroutine resumes.
+//
+
+struct timed_out {};
+
+template<typename T, typename Signal>
+struct signal_ref {
+    T * src;
+    Signal method;
+};
+
+template<typename T, typename Signal>
+signal_ref<T, Signal>
+on(T * src, Signal method) {
+    return signal_ref<T, Signal>{src, method};
+}
+
+namespace detail {
+
+// nullary signals have no value, but a variant needs a type
+template<typename Result>
+struct variant_value {
+    using type = Result;
+};
+
+template<>
+struct variant_value<void> {
+    using type = std::monostate;
+};
+
+template<typename Ref>
+using ref_value_t = typename variant_value<typename signal_args_t<decltype(Ref::method)>::type>::type;
+
+}
+
+template<bool Timed, typename... Refs>
+struct when_any_awaitable {
+    using result_t = std::conditional_t<Timed,
+                                        std::variant<detail::ref_value_t<Refs>..., timed_out>,
+                                        std::variant<detail::ref_value_t<Refs>...>>;
+
+    when_any_awaitable(std::tuple<Refs...> refs, int msec)
+        : refs_(refs), msec_(msec) {}
+
+    when_any_awaitable(when_any_awaitable const&) = delete;
+    when_any_awaitable& operator=(when_any_awaitable const&) = delete;
+
+    ~when_any_awaitable() {
+        disconnect_all();   // in case the coroutine is destroyed while waiting
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template<typename P>
+    void await_suspend(std::experimental::coroutine_handle<P> handle) {
+        coro_handle_ = handle;
+        connect_all(std::index_sequence_for<Refs...>());
+        if constexpr (Timed) {
+            timer_.setSingleShot(true);
+            timer_conn_ = QObject::connect(&timer_, &QTimer::timeout, &timer_,
+                                           [this]() { finish<sizeof...(Refs)>(); });
+            timer_.start(msec_);
+        }
+    }
+
+    result_t await_resume() {
+        return std::move(*result_);
+    }
+
+private:
+    template<std::size_t... I>
+    void connect_all(std::index_sequence<I...>) {
+        // each slot takes its signal's parameters minus any QPrivateSignal
+        (connect_one<I>(static_cast<typename signal_args_t<decltype(Refs::method)>::no_empty_t*>(nullptr)), ...);
+    }
+
+    template<std::size_t I, typename... Args>
+    void connect_one(std::tuple<Args...>*) {
+        // the timer lives in the awaiting thread, so as the context object it
+        // makes a signal from another thread a queued call to there
+        auto & ref = std::get<I>(refs_);
+        conns_[I] = QObject::connect(ref.src, ref.method, &timer_,
+                                     [this](Args... a) { finish<I>(a...); });
+    }
+
+    void disconnect_all() {
+        for (auto & c : conns_) {
+            QObject::disconnect(c);
+        }
+        if constexpr (Timed) {
+            timer_.stop();
+            QObject::disconnect(timer_conn_);
+        }
+    }
+
+    template<std::size_t I, typename... Args>
+    void finish(Args const&... a) {
+        if (result_) {
+            return;     // another one fired first, within the same emission
+        }
+        disconnect_all();
+        result_.emplace(std::in_place_index<I>, a...);
+        auto handle = coro_handle_;
+        coro_handle_ = nullptr;
+        handle.resume();
+    }
+
+    std::tuple<Refs...> refs_;
+    int msec_;
+    std::array<QMetaObject::Connection, sizeof...(Refs)> conns_;
+    QTimer timer_;          // also the context object for every slot, timed or not
+    QMetaObject::Connection timer_conn_;
+    std::optional<result_t> result_;
+    std::experimental::coroutine_handle<> coro_handle_;
+};
+
+namespace detail {
+
+// all but the last argument are signals; the last is the timeout
+template<typename Args, std::size_t... I>
+when_any_awaitable<true, std::tuple_element_t<I, Args>...>
+make_timed_when_any(Args args, std::index_sequence<I...>) {
+    return when_any_awaitable<true, std::tuple_element_t<I, Args>...>{
+        std::make_tuple(std::get<I>(args)...),
+        static_cast<int>(std::get<sizeof...(I)>(args))};
+}
+
+}
+
+template<typename... Args>
+auto when_any(Args... args) {
+    static_assert(sizeof...(Args) != 0, "when_any needs at least one signal");
+    using last_t = std::tuple_element_t<sizeof...(Args) - 1, std::tuple<Args...>>;
+    if constexpr (std::is_integral_v<last_t>) {
+        static_assert(sizeof...(Args) > 1, "when_any needs at least one signal");
+        return detail::make_timed_when_any(std::make_tuple(args...),
+                                           std::make_index_sequence<sizeof...(Args) - 1>());
+    } else {
+        return when_any_awaitable<false, Args...>{std::make_tuple(args...), 0};
+    }
+}
+
+//
+// Offloading work to a thread pool
+// co_await qtcoro::run_in_pool(context, f) runs f() on a QThreadPool thread,
+// keeping the GUI thread free to paint, and resumes the coroutine on the
+// thread of the context object with f's result (or rethrows its exception).
+// The awaiter is itself the QRunnable and holds the result, and both live in
+// the coroutine frame, so neither handing the work over nor getting the result
+// back allocates; the one allocation left is Qt's event for the queued call.
+// The coroutine must not be destroyed while the work is in flight.
+//
+
+namespace detail {
+
+template<typename R>
+struct pool_result {
+    template<typename F>
+    void run(F& f) { value_.emplace(f()); }
+
+    R get() { return std::move(*value_); }
+
+private:
+    std::optional<R> value_;
+};
+
+template<>
+struct pool_result<void> {
+    template<typename F>
+    void run(F& f) { f(); }
+
+    void get() noexcept {}
+};
+
+}
+
+template<typename F>
+struct pool_awaiter : QRunnable {
+    using result_t = std::invoke_result_t<F&>;
+
+    pool_awaiter(QObject * context, F f, QThreadPool * pool)
+        : context_(context), f_(std::move(f)), pool_(pool) {
+        setAutoDelete(false);   // the pool must not delete us; the coroutine frame owns us
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template<typename P>
+    void await_suspend(std::experimental::coroutine_handle<P> handle) {
+        coro_handle_ = handle;
+        pool_->start(this);
+    }
+
+    result_t await_resume() {
+        if (error_) {
+            std::rethrow_exception(error_);
+        }
+        return result_.get();
+    }
+
+    // called on a pool thread
+    void run() override {
+        try {
+            result_.run(f_);
+        } catch (...) {
+            error_ = std::current_exception();
+        }
+        // the queued call gets us back to the context's thread, and the event
+        // queue's locking makes the result visible there. Once it is posted the
+        // coroutine may resume, and destroy us, at any moment, so copy the handle
+        auto handle = coro_handle_;
+        QMetaObject::invokeMethod(context_, [handle]() { handle.resume(); }, Qt::QueuedConnection);
+    }
+
+private:
+    QObject * context_;
+    F f_;
+    QThreadPool * pool_;
+    detail::pool_result<result_t> result_;
+    std::exception_ptr error_;
+    std::experimental::coroutine_handle<> coro_handle_;
+};
+
+template<typename F>
+pool_awaiter<F>
+run_in_pool(QObject * context, F f, QThreadPool * pool = QThreadPool::globalInstance()) {
+    return pool_awaiter<F>{context, std::move(f), pool};
+}
+
 //
 // some light metaprogramming
 //
@@ -0,0 +1,172 @@
+// Load generator for the muladd RPC server
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Opens many connections to rpcs (rpc_server.cpp) and on each one repeatedly
+// sends a pipelined batch of requests in a single write, then collects the
+// responses, timing each one from the write to its arrival.
+// Reports throughput and latency percentiles.
+//
+// usage: rpcc [--host H] [--port P] [--connections C] [--depth D]
+//             [--requests N] [--threads T]
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include <experimental/coroutine>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+#include "histogram.hpp"
+#include "io_context_pool.hpp"
+#include "rpc_proto.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::co_spawn;
+using boost::asio::ip::tcp;
+using boost::asio::use_awaitable;
+namespace this_coro = boost::asio::this_coro;
+
+// per-shard results, merged after the pool stops
+struct client_shard {
+    latency_histogram latency;
+    std::uint64_t errors = 0;     // wrong answers or failed connections
+};
+
+awaitable<void> client_connection(tcp::endpoint server, client_shard& shard,
+                                  std::atomic<std::int64_t>& remaining, std::size_t depth) {
+    try {
+        tcp::socket socket(co_await this_coro::executor);
+        co_await socket.async_connect(server, use_awaitable);
+        socket.set_option(tcp::no_delay(true));
+
+        std::vector<unsigned char> out(depth * rpc::request_size);
+        std::vector<unsigned char> in(depth * rpc::response_size);
+        std::uint32_t next_id = 0;
+
+        while (true) {
+            // claim up to "depth" requests from the shared budget
+            std::int64_t available = remaining.fetch_sub(static_cast<std::int64_t>(depth),
+                                                         std::memory_order_relaxed);
+            if (available <= 0) {
+                break;
+            }
+            std::size_t batch = std::min(static_cast<std::size_t>(available), depth);
+            std::uint32_t first_id = next_id;
+            for (std::size_t i = 0; i < batch; ++i) {
+                rpc::encode(rpc::request{next_id, 2, 3, static_cast<std::int32_t>(next_id)},
+                            out.data() + i * rpc::request_size);
+                ++next_id;
+            }
+
+            auto sent = std::chrono::steady_clock::now();
+            co_await boost::asio::async_write(socket,
+                                              boost::asio::buffer(out.data(), batch * rpc::request_size),
+                                              use_awaitable);
+
+            // collect responses as they arrive
+            std::size_t expected = batch * rpc::response_size;
+            std::size_t have = 0;
+            std::size_t checked = 0;
+            while (have < expected) {
+                have += co_await socket.async_read_some(
+                    boost::asio::buffer(in.data() + have, expected - have), use_awaitable);
+                auto arrived = std::chrono::steady_clock::now();
+                auto ns = std::chrono::duration_cast<std::chrono::nanoseconds>(arrived - sent).count();
+                for (; (checked + 1) * rpc::response_size <= have; ++checked) {
+                    auto resp = rpc::decode_response(in.data() + checked * rpc::response_size);
+                    std::uint32_t id = first_id + static_cast<std::uint32_t>(checked);
+                    if (resp.id != id || resp.result != rpc::muladd(2, 3, static_cast<std::int32_t>(id))) {
+                        ++shard.errors;
+                    }
+                    shard.latency.record(static_cast<std::uint64_t>(ns));
+                }
+            }
+        }
+    } catch (std::exception const&) {
+        ++shard.errors;
+    }
+}
+
+int main(int argc, char** argv) {
+    std::string host = "127.0.0.1";
+    std::uint16_t port = rpc::default_port;
+    std::size_t connections = 100;
+    std::size_t depth = 16;
+    std::size_t requests = 1000000;
+    std::size_t threads = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        std::string value = argv[i + 1];
+        if (arg == "--host") {
+            host = value;
+        } else if (arg == "--port") {
+            port = static_cast<std::uint16_t>(std::stoul(value));
+        } else if (arg == "--connections") {
+            connections = std::stoul(value);
+        } else if (arg == "--depth") {
+            depth = std::max<std::size_t>(1, std::stoul(value));
+        } else if (arg == "--requests") {
+            requests = std::stoul(value);
+        } else if (arg == "--threads") {
+            threads = std::stoul(value);
+        }
+    }
+
+    io_context_pool pool(threads);
+    std::vector<client_shard> shards(pool.size());
+    std::atomic<std::int64_t> remaining{static_cast<std::int64_t>(requests)};
+    tcp::endpoint server(boost::asio::ip::make_address(host), port);
+
+    for (std::size_t i = 0; i < connections; ++i) {
+        co_spawn(pool.shard(i), client_connection(server, shards[i % shards.size()], remaining, depth),
+                 boost::asio::detached);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    pool.run();
+    std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+
+    latency_histogram latency;
+    std::uint64_t errors = 0;
+    for (auto const& s : shards) {
+        latency.merge(s.latency);
+        errors += s.errors;
+    }
+
+    std::cout << latency.count() << " requests over " << connections << " connections, depth "
+              << depth << ", " << pool.size() << " threads, " << errors << " errors\n";
+    std::cout << "throughput: " << latency.count() / elapsed.count() << " requests/s\n";
+    std::cout << "latency (us): p50 " << latency.percentile(50) / 1000.0
+              << "  p99 " << latency.percentile(99) / 1000.0
+              << "  p99.9 " << latency.percentile(99.9) / 1000.0
+              << "  max " << latency.max() / 1000.0 << "\n";
+    return errors == 0 ? 0 : 1;
+}
@@ -0,0 +1,102 @@
+// Wire format for the muladd RPC example
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef RPC_PROTO_HPP
+#define RPC_PROTO_HPP
+
+// Fixed-size little-endian frames, with no length prefix needed:
+//   request:  u32 id, i32 a, i32 b, i32 c    (16 bytes)
+//   response: u32 id, i32 a*b+c              (8 bytes)
+// a*b+c wraps around, as 32-bit unsigned arithmetic would (see muladd below),
+// so any a, b and c a client sends have a defined answer.
+// Responses on a connection come back in request order; the id is there
+// so clients can check.
+
+#include <cstddef>
+#include <cstdint>
+
+namespace rpc {
+
+constexpr std::uint16_t default_port = 5555;
+
+constexpr std::size_t request_size  = 16;
+constexpr std::size_t response_size = 8;
+
+struct request {
+    std::uint32_t id;
+    std::int32_t  a;
+    std::int32_t  b;
+    std::int32_t  c;
+};
+
+struct response {
+    std::uint32_t id;
+    std::int32_t  result;
+};
+
+// the answer to a request: a*b+c modulo 2^32, as a two's complement i32
+inline std::int32_t muladd(std::int32_t a, std::int32_t b, std::int32_t c) noexcept {
+    return static_cast<std::int32_t>(static_cast<std::uint32_t>(a) * static_cast<std::uint32_t>(b) +
+                                     static_cast<std::uint32_t>(c));
+}
+
+inline void put_u32(unsigned char* p, std::uint32_t v) noexcept {
+    p[0] = static_cast<unsigned char>(v);
+    p[1] = static_cast<unsigned char>(v >> 8);
+    p[2] = static_cast<unsigned char>(v >> 16);
+    p[3] = static_cast<unsigned char>(v >> 24);
+}
+
+inline std::uint32_t get_u32(unsigned char const* p) noexcept {
+    return static_cast<std::uint32_t>(p[0]) |
+        (static_cast<std::uint32_t>(p[1]) << 8) |
+        (static_cast<std::uint32_t>(p[2]) << 16) |
+        (static_cast<std::uint32_t>(p[3]) << 24);
+}
+
+inline void encode(request const& r, unsigned char* p) noexcept {
+    put_u32(p,      r.id);
+    put_u32(p + 4,  static_cast<std::uint32_t>(r.a));
+    put_u32(p + 8,  static_cast<std::uint32_t>(r.b));
+    put_u32(p + 12, static_cast<std::uint32_t>(r.c));
+}
+
+inline request decode_request(unsigned char const* p) noexcept {
+    return request{get_u32(p),
+                   static_cast<std::int32_t>(get_u32(p + 4)),
+                   static_cast<std::int32_t>(get_u32(p + 8)),
+                   static_cast<std::int32_t>(get_u32(p + 12))};
+}
+
+inline void encode(response const& r, unsigned char* p) noexcept {
+    put_u32(p,     r.id);
+    put_u32(p + 4, static_cast<std::uint32_t>(r.result));
+}
+
+inline response decode_response(unsigned char const* p) noexcept {
+    return response{get_u32(p), static_cast<std::int32_t>(get_u32(p + 4))};
+}
+
+}
+
+#endif // RPC_PROTO_HPP
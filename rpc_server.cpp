@@ -0,0 +1,266 @@
+// A muladd RPC server using Asio coroutines
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// Serves a*b+c over TCP using the framing in rpc_proto.hpp, in the coroutine
+// style of asio_coro.cpp. Each connection has a reader and a writer coroutine:
+// the reader handles every complete request it finds in each read, so clients
+// can pipeline, and queues one batch of responses per read. The writer sends
+// all batches queued while its previous write was in flight with a single
+// gathering write. Connections are spread over an io_context_pool, and both
+// coroutines of a connection live on the same shard, so nothing is locked.
+// A client that sends faster than it reads is held back: once a connection
+// has max_pending bytes of responses queued, its reader stops reading until
+// the writer takes them.
+// On SIGINT or SIGTERM the server stops and reports how many requests each
+// read and write system call carried.
+//
+// usage: rpcs [--port P] [--threads N]     (N = 0, the default, means one per core)
+
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include <experimental/coroutine>
+#include <boost/asio/co_spawn.hpp>
+#include <boost/asio/detached.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/redirect_error.hpp>
+#include <boost/asio/signal_set.hpp>
+#include <boost/asio/steady_timer.hpp>
+#include <boost/asio/use_awaitable.hpp>
+#include <boost/asio/write.hpp>
+
+#include "io_context_pool.hpp"
+#include "rpc_proto.hpp"
+
+using boost::asio::awaitable;
+using boost::asio::co_spawn;
+using boost::asio::ip::tcp;
+using boost::asio::use_awaitable;
+
+// per-shard counters; only touched by the shard's thread until the pool stops
+struct shard_stats {
+    std::uint64_t connections = 0;
+    std::uint64_t requests = 0;
+    std::uint64_t reads = 0;
+    std::uint64_t writes = 0;
+};
+
+constexpr std::size_t max_pending = 1024 * 1024;
+
+// what the reader and writer coroutines of a connection share
+struct connection {
+    explicit connection(tcp::socket s)
+        : socket(std::move(s)), wakeup(socket.get_executor()), drained(socket.get_executor()) {}
+
+    // response buffers are recycled so a busy connection stops allocating
+    std::vector<unsigned char> take_buffer() {
+        if (spare.empty()) {
+            return {};
+        }
+        auto b = std::move(spare.back());
+        spare.pop_back();
+        return b;
+    }
+
+    tcp::socket socket;
+    boost::asio::steady_timer wakeup;                    // the writer sleeps on this
+    boost::asio::steady_timer drained;                   // and the reader on this, when too far ahead
+    std::vector<std::vector<unsigned char>> pending;     // encoded response batches, in order
+    std::size_t pending_bytes = 0;
+    std::vector<std::vector<unsigned char>> spare;
+    bool eof = false;       // the client has sent all it will: answer what's queued, then shut down
+    bool closed = false;    // a failure, on either side: stop now
+};
+
+awaitable<void> reader(std::shared_ptr<connection> conn, shard_stats& stats) {
+    ++stats.connections;
+    std::vector<unsigned char> in(64 * 1024);
+    std::size_t have = 0;
+    try {
+        while (true) {
+            boost::system::error_code ec;
+            std::size_t n = co_await conn->socket.async_read_some(
+                boost::asio::buffer(in.data() + have, in.size() - have),
+                boost::asio::redirect_error(use_awaitable, ec));
+            if (ec == boost::asio::error::eof) {
+                conn->eof = true;   // a half-close; the writer still owes it responses
+                break;
+            }
+            if (ec) {
+                conn->closed = true;
+                break;
+            }
+            ++stats.reads;
+            have += n;
+
+            // answer every complete request in the buffer at once
+            std::size_t count = have / rpc::request_size;
+            if (count != 0) {
+                auto batch = conn->take_buffer();
+                batch.resize(count * rpc::response_size);
+                for (std::size_t i = 0; i < count; ++i) {
+                    auto req = rpc::decode_request(in.data() + i * rpc::request_size);
+                    rpc::encode(rpc::response{req.id, rpc::muladd(req.a, req.b, req.c)},
+                                batch.data() + i * rpc::response_size);
+                }
+                stats.requests += count;
+                conn->pending_bytes += batch.size();
+                conn->pending.push_back(std::move(batch));
+                conn->wakeup.cancel_one();
+
+                // keep any partial request for the next read
+                std::size_t used = count * rpc::request_size;
+                std::memmove(in.data(), in.data() + used, have - used);
+                have -= used;
+            }
+
+            // the client isn't reading its responses fast enough: wait for the writer
+            while (conn->pending_bytes > max_pending && !conn->closed) {
+                boost::system::error_code ec;
+                conn->drained.expires_at(boost::asio::steady_timer::time_point::max());
+                co_await conn->drained.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+            }
+            if (conn->closed) {
+                break;      // the writer gave up
+            }
+        }
+    } catch (std::exception const&) {
+        conn->closed = true;
+    }
+    conn->wakeup.cancel();
+}
+
+awaitable<void> writer(std::shared_ptr<connection> conn, shard_stats& stats) {
+    std::vector<std::vector<unsigned char>> writing;
+    std::vector<boost::asio::const_buffer> gather;
+    try {
+        while (!conn->closed) {
+            if (conn->pending.empty()) {
+                if (conn->eof) {
+                    // all answered; let the client see the end of the stream
+                    boost::system::error_code ec;
+                    conn->socket.shutdown(tcp::socket::shutdown_send, ec);
+                    break;
+                }
+                // sleep until the reader queues something, or stops (it cancels the wait)
+                boost::system::error_code ec;
+                conn->wakeup.expires_at(boost::asio::steady_timer::time_point::max());
+                co_await conn->wakeup.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+                continue;
+            }
+
+            // everything queued so far goes out in one gathering write
+            writing.swap(conn->pending);
+            conn->pending_bytes = 0;
+            conn->drained.cancel();
+            gather.clear();
+            for (auto const& batch : writing) {
+                gather.push_back(boost::asio::buffer(batch));
+            }
+            co_await boost::asio::async_write(conn->socket, gather, use_awaitable);
+            ++stats.writes;
+
+            for (auto & batch : writing) {
+                conn->spare.push_back(std::move(batch));
+            }
+            writing.clear();
+        }
+    } catch (std::exception const&) {
+    }
+    conn->closed = true;
+    conn->drained.cancel();
+}
+
+awaitable<void> listener(tcp::acceptor acceptor, io_context_pool& pool,
+                         std::vector<shard_stats>& stats) {
+    boost::asio::steady_timer backoff(acceptor.get_executor());
+    for (std::size_t next = 0; ; ++next) {
+        std::size_t shard = next % pool.size();
+        boost::system::error_code ec;
+        tcp::socket socket = co_await acceptor.async_accept(pool.shard(shard),
+                                                            boost::asio::redirect_error(use_awaitable, ec));
+        if (ec == boost::asio::error::operation_aborted) {
+            co_return;      // the acceptor was closed
+        }
+        if (ec) {
+            // out of descriptors, or a connection reset before we took it:
+            // neither is a reason to stop accepting for good
+            std::cerr << "accept failed: " << ec.message() << "\n";
+            backoff.expires_after(std::chrono::milliseconds(100));
+            co_await backoff.async_wait(boost::asio::redirect_error(use_awaitable, ec));
+            continue;
+        }
+        socket.set_option(tcp::no_delay(true), ec);     // a failure here will show up on the first read
+
+        auto conn = std::make_shared<connection>(std::move(socket));
+        co_spawn(conn->socket.get_executor(), reader(conn, stats[shard]), boost::asio::detached);
+        co_spawn(conn->socket.get_executor(), writer(conn, stats[shard]), boost::asio::detached);
+    }
+}
+
+int main(int argc, char** argv) {
+    std::uint16_t port = rpc::default_port;
+    std::size_t threads = 0;
+    for (int i = 1; i + 1 < argc; i += 2) {
+        std::string arg = argv[i];
+        if (arg == "--port") {
+            port = static_cast<std::uint16_t>(std::stoul(argv[i + 1]));
+        } else if (arg == "--threads") {
+            threads = std::stoul(argv[i + 1]);
+        }
+    }
+
+    io_context_pool pool(threads);
+    std::vector<shard_stats> stats(pool.size());
+
+    auto& io = pool.shard(0);
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), port));
+    co_spawn(io, listener(std::move(acceptor), pool, stats), boost::asio::detached);
+
+    boost::asio::signal_set signals(io, SIGINT, SIGTERM);
+    signals.async_wait([&](boost::system::error_code, int) { pool.stop(); });
+
+    std::cout << "serving muladd on 127.0.0.1:" << port << " with "
+              << pool.size() << " threads\n";
+    pool.run_until_stopped();
+
+    shard_stats total;
+    for (auto const& s : stats) {
+        total.connections += s.connections;
+        total.requests    += s.requests;
+        total.reads       += s.reads;
+        total.writes      += s.writes;
+    }
+    std::cout << total.connections << " connections, " << total.requests << " requests, "
+              << total.reads << " reads, " << total.writes << " writes\n";
+    if (total.requests != 0) {
+        std::cout << "syscalls per request: "
+                  << static_cast<double>(total.reads + total.writes) / static_cast<double>(total.requests)
+                  << "\n";
+    }
+}
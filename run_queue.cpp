@@ -23,9 +23,124 @@ SOFTWARE.
 
 #include "run_queue.hpp"
 
+#include <limits>
+#include <ostream>
+
 void run_queue::run() {
-    while (!tasks_.empty()) {
-        tasks_.front()(this);
+    run_up_to(std::numeric_limits<std::size_t>::max());
+}
+
+std::size_t run_queue::run_available() {
+    return run_up_to(tasks_.size());
+}
+
+std::size_t run_queue::run_up_to(std::size_t limit) {
+    std::size_t count = 0;
+    while (count != limit && !tasks_.empty()) {
+        // checked per task, as a task may turn metrics on
+        if (metrics_) {
+            return count + run_measured(limit - count);
+        }
+        tasks_.front().fn(this);
         tasks_.pop();
+        ++count;
+    }
+    return count;
+}
+
+std::size_t run_queue::run_measured(std::size_t limit) {
+    auto& m = *metrics_;
+    std::lock_guard<std::mutex> running(m.running);
+    std::size_t count = 0;
+    while (count != limit && !tasks_.empty()) {
+        auto& e = tasks_.front();
+        if (e.enqueued != 0) {
+            auto start = metrics::now();
+            m.local.wait.record(start - e.enqueued);
+            e.fn(this);
+            m.local.service.record(metrics::now() - start);
+        } else {
+            e.fn(this);
+        }
+        tasks_.pop();
+        m.depth.store(tasks_.size(), std::memory_order_relaxed);
+        ++m.local.tasks;
+        ++count;
+        if (m.wanted.load(std::memory_order_relaxed)) {
+            m.publish();
+        }
+    }
+    m.local.batch.record(count);
+    return count;
+}
+
+void run_queue::enable_metrics(std::size_t sample_every) {
+    if (!metrics_) {
+        metrics_ = std::make_unique<metrics>(sample_every);
+        // tasks already queued are counted when they run, but have no timestamps
+        metrics_->set_depth(tasks_.size());
+    }
+}
+
+// with "running" held, by run() or by snapshot()
+void run_queue::metrics::publish() {
+    // take the high water mark, and start the next one from the current depth
+    local.depth_high_water = depth_high_water.exchange(depth.load(std::memory_order_relaxed),
+                                                       std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(published_mutex);
+        published.merge(local);
+        ++generation;
+        wanted.store(false, std::memory_order_relaxed);
     }
+    local = run_queue_stats{};
+    published_cv.notify_all();
+}
+
+run_queue_stats run_queue::snapshot(bool reset) {
+    if (!metrics_) {
+        return run_queue_stats{};
+    }
+    auto& m = *metrics_;
+    std::unique_lock<std::mutex> running(m.running, std::try_to_lock);
+    if (running) {
+        // no run() in progress, so the local counters are ours to merge
+        m.publish();
+    } else {
+        // ask the running thread to hand over its counters after its current task;
+        // if its run() ends before it sees the request, take them ourselves
+        std::unique_lock<std::mutex> lock(m.published_mutex);
+        auto generation = m.generation;
+        m.wanted.store(true, std::memory_order_relaxed);
+        while (m.generation == generation) {
+            if (m.running.try_lock()) {
+                running = std::unique_lock<std::mutex>(m.running, std::adopt_lock);
+                lock.unlock();
+                m.publish();
+                break;
+            }
+            m.published_cv.wait_for(lock, std::chrono::milliseconds(1));
+        }
+    }
+    std::lock_guard<std::mutex> lock(m.published_mutex);
+    auto result = m.published;
+    if (reset) {
+        m.published = run_queue_stats{};
+    }
+    return result;
+}
+
+void report(std::ostream& os, run_queue_stats const& stats) {
+    auto summary = [&os](char const* name, latency_histogram const& h) {
+        os << ",\"" << name << "\":{\"mean\":" << h.mean()
+           << ",\"p50\":" << h.percentile(50)
+           << ",\"p99\":" << h.percentile(99)
+           << ",\"max\":" << h.max() << "}";
+    };
+    os << "{\"tasks\":" << stats.tasks
+       << ",\"depth_high_water\":" << stats.depth_high_water;
+    summary("wait_ns", stats.wait);
+    summary("service_ns", stats.service);
+    summary("batch_tasks", stats.batch);
+    os << "}\n";
 }
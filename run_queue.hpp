@@ -24,26 +24,140 @@ SOFTWARE.
 #ifndef RUN_QUEUE_HPP
 #define RUN_QUEUE_HPP
 
-#include <queue>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
 #include <functional>
+#include <iosfwd>
+#include <memory>
+#include <mutex>
+#include <queue>
+
+#include "histogram.hpp"
 
 // solely for the purpose of queueing up work to run later, as a way to test callbacks etc.
 // This run queue does as little as possible:
 // all you can do is queue tasks; a single thread runs them, and when there are none remaining
 // it exits
 
+// What a run queue has been doing, for sizing pools and spotting overload.
+// Times are in nanoseconds.
+struct run_queue_stats {
+    latency_histogram wait;         // from add_task() to the task starting
+    latency_histogram service;      // running the task
+    latency_histogram batch;        // tasks run per call to run() or run_available()
+    std::uint64_t tasks = 0;
+    std::size_t depth_high_water = 0;
+
+    void merge(run_queue_stats const& other) noexcept {
+        wait.merge(other.wait);
+        service.merge(other.service);
+        batch.merge(other.batch);
+        tasks += other.tasks;
+        depth_high_water = std::max(depth_high_water, other.depth_high_water);
+    }
+};
+
+// one JSON object per line, like the benchmarks
+void report(std::ostream& os, run_queue_stats const& stats);
+
 struct run_queue {
     using task = std::function<void(run_queue*)>;
 
     template<typename F>
     void add_task(F f) {
-        tasks_.push(std::move(f));
+        if (metrics_) {
+            tasks_.push(entry{std::move(f), 0});
+            tasks_.back().enqueued = metrics_->enqueued(tasks_.size());
+        } else {
+            tasks_.push(entry{std::move(f), 0});
+        }
     }
 
     void run();
 
+    // Runs only the tasks that were queued when it was called, leaving any they
+    // add for next time, so an event loop calling it can't be starved by tasks
+    // that keep requeueing themselves. Returns how many ran.
+    std::size_t run_available();
+
+    bool empty() const { return tasks_.empty(); }
+
+    // Metrics are off until this is called, and cost one test per task when off.
+    // Call it from the thread that uses the queue, before any other thread
+    // takes a snapshot(); from inside a task is fine.
+    // Counts of tasks, batches and the queue depth are exact. Wait and service
+    // times are sampled, one task in sample_every, as reading the clock costs
+    // more than a hop through the queue; tasks queued before this aren't sampled.
+    void enable_metrics(std::size_t sample_every = 16);
+
+    // The metrics so far; optionally start over. Unlike everything else here
+    // this may be called from any thread, e.g. to dump them periodically.
+    // The running thread keeps its own counters and hands them over only when
+    // asked, so if a run() is in progress this waits for its current task.
+    // The only thing shared with add_task() is the depth, which is atomic.
+    run_queue_stats snapshot(bool reset = false);
+
 private:
-    std::queue<task> tasks_;
+    struct entry {
+        task fn;
+        std::uint64_t enqueued;     // a timestamp if sampled, otherwise 0
+    };
+
+    struct metrics {
+        static std::uint64_t now() noexcept {
+            return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::steady_clock::now().time_since_epoch()).count());
+        }
+
+        explicit metrics(std::size_t every)
+            : sample_every(every ? every : 1), until_sample(sample_every) {}
+
+        // the new task's timestamp, or 0 if it isn't sampled
+        std::uint64_t enqueued(std::size_t new_depth) noexcept {
+            set_depth(new_depth);
+            if (--until_sample != 0) {
+                return 0;
+            }
+            until_sample = sample_every;
+            return now();
+        }
+
+        // only the queue's thread writes these, so no read-modify-write is needed
+        void set_depth(std::size_t d) noexcept {
+            depth.store(d, std::memory_order_relaxed);
+            if (d > depth_high_water.load(std::memory_order_relaxed)) {
+                depth_high_water.store(d, std::memory_order_relaxed);
+            }
+        }
+
+        std::size_t const sample_every;
+        std::size_t until_sample;       // the queue's thread only
+        std::atomic<std::size_t> depth{0};
+        std::atomic<std::size_t> depth_high_water{0};
+
+        // kept by run(), and by snapshot() only while it holds "running"
+        run_queue_stats local;
+
+        // held for the duration of each run()
+        std::mutex running;
+
+        // local counters handed over to snapshot()
+        std::atomic<bool> wanted{false};
+        std::mutex published_mutex;
+        std::condition_variable published_cv;
+        run_queue_stats published;
+        std::uint64_t generation = 0;
+
+        void publish();
+    };
+
+    std::size_t run_up_to(std::size_t limit);
+    std::size_t run_measured(std::size_t limit);
+
+    std::queue<entry> tasks_;
+    std::unique_ptr<metrics> metrics_;
 };
 
 #endif // RUN_QUEUE_HPP
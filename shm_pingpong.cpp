@@ -0,0 +1,261 @@
+// Ping-pong and throughput between two processes: shared-memory rings vs. loopback TCP
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+// A child process answers muladd requests (the messages from rpc_proto.hpp)
+// sent by its parent, first over a pair of shm_rings and then over a loopback
+// TCP connection. Both sides are await_return_object coroutines driven by an
+// io_context; the TCP side awaits Asio operations through use_resume.
+// "pingpong" waits for each answer before sending the next request (latency);
+// "pipelined" sends and receives concurrently (throughput).
+// Output is in the format of coro_bench.cpp.
+//
+// usage: shmpp [iterations]
+
+#include <cstdint>
+#include <iostream>
+
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <experimental/coroutine>
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/ip/tcp.hpp>
+#include <boost/asio/read.hpp>
+#include <boost/asio/write.hpp>
+
+#include "asio_bridge.hpp"
+#include "bench.hpp"
+#include "co_awaiter.hpp"
+#include "rpc_proto.hpp"
+#include "shm_ring.hpp"
+
+using boost::asio::io_context;
+using boost::asio::ip::tcp;
+
+constexpr std::size_t ring_capacity = 1024;
+constexpr std::uint32_t stop_id = 0xffffffff;
+
+using request_sender    = shm_sender<rpc::request, ring_capacity>;
+using request_receiver  = shm_receiver<rpc::request, ring_capacity>;
+using response_sender   = shm_sender<rpc::response, ring_capacity>;
+using response_receiver = shm_receiver<rpc::response, ring_capacity>;
+
+namespace detail {
+static std::size_t errors = 0;
+}
+
+void check(rpc::response const& resp, std::uint32_t id) {
+    if (resp.id != id || resp.result != rpc::muladd(2, 3, static_cast<std::int32_t>(id))) {
+        ++detail::errors;
+    }
+}
+
+//
+// Shared memory
+//
+
+// child: answer requests in place until told to stop
+await_return_object<> shm_server(request_receiver& rx, response_sender& tx) {
+    while (true) {
+        rpc::request& req = co_await rx.receive();
+        if (req.id == stop_id) {
+            rx.release();
+            break;
+        }
+        auto slot = co_await tx.claim();
+        *slot.value = rpc::response{req.id, rpc::muladd(req.a, req.b, req.c)};
+        rx.release();
+        tx.publish(slot);
+    }
+}
+
+await_return_object<> shm_pingpong(request_sender& tx, response_receiver& rx, std::size_t n) {
+    for (std::uint32_t i = 0; i < n; ++i) {
+        co_await tx.send(rpc::request{i, 2, 3, static_cast<std::int32_t>(i)});
+        check(co_await rx.receive(), i);
+        rx.release();
+    }
+}
+
+await_return_object<> shm_send_all(request_sender& tx, std::size_t n) {
+    for (std::uint32_t i = 0; i < n; ++i) {
+        co_await tx.send(rpc::request{i, 2, 3, static_cast<std::int32_t>(i)});
+    }
+}
+
+await_return_object<> shm_receive_all(response_receiver& rx, std::size_t n) {
+    for (std::uint32_t i = 0; i < n; ++i) {
+        check(co_await rx.receive(), i);
+        rx.release();
+    }
+}
+
+await_return_object<> shm_stop(request_sender& tx) {
+    co_await tx.send(rpc::request{stop_id, 0, 0, 0});
+}
+
+void run_shm(std::size_t n) {
+    using request_ring  = shm_ring<rpc::request, ring_capacity>;
+    using response_ring = shm_ring<rpc::response, ring_capacity>;
+
+    shm_region region(sizeof(request_ring) + sizeof(response_ring));
+    auto* requests  = region.construct<request_ring>();
+    auto* responses = region.construct<response_ring>(sizeof(request_ring));
+    auto request_bells  = shm_doorbells::create();
+    auto response_bells = shm_doorbells::create();
+
+    pid_t child = ::fork();
+    if (child == 0) {
+        io_context io;
+        request_receiver rx(io, *requests, request_bells);
+        response_sender tx(io, *responses, response_bells);
+        auto server = shm_server(rx, tx);
+        io.run();
+        ::_exit(0);
+    }
+
+    io_context io;
+    request_sender tx(io, *requests, request_bells);
+    response_receiver rx(io, *responses, response_bells);
+
+    bench::report(std::cout, bench::measure("shm/pingpong", n, [&](std::size_t k) {
+                auto coro = shm_pingpong(tx, rx, k);
+                io.run();
+                io.restart();
+            }));
+    bench::report(std::cout, bench::measure("shm/pipelined", n, [&](std::size_t k) {
+                auto sender = shm_send_all(tx, k);
+                auto receiver = shm_receive_all(rx, k);
+                io.run();
+                io.restart();
+            }));
+
+    auto stop = shm_stop(tx);
+    io.run();
+    ::waitpid(child, nullptr, 0);
+}
+
+//
+// Loopback TCP, one read or write per message
+//
+
+await_return_object<> tcp_server(tcp::socket& socket) {
+    unsigned char in[rpc::request_size];
+    unsigned char out[rpc::response_size];
+    while (true) {
+        auto [rec, rn] = co_await boost::asio::async_read(socket, boost::asio::buffer(in), use_resume);
+        if (rec) {
+            break;      // parent closed the connection
+        }
+        auto req = rpc::decode_request(in);
+        rpc::encode(rpc::response{req.id, rpc::muladd(req.a, req.b, req.c)}, out);
+        auto [wec, wn] = co_await boost::asio::async_write(socket, boost::asio::buffer(out), use_resume);
+        if (wec) {
+            break;
+        }
+    }
+}
+
+await_return_object<> tcp_send_all(tcp::socket& socket, std::size_t n) {
+    unsigned char out[rpc::request_size];
+    for (std::uint32_t i = 0; i < n; ++i) {
+        rpc::encode(rpc::request{i, 2, 3, static_cast<std::int32_t>(i)}, out);
+        auto [ec, len] = co_await boost::asio::async_write(socket, boost::asio::buffer(out), use_resume);
+        if (ec) {
+            ++detail::errors;
+            break;
+        }
+    }
+}
+
+await_return_object<> tcp_receive_all(tcp::socket& socket, std::size_t n) {
+    unsigned char in[rpc::response_size];
+    for (std::uint32_t i = 0; i < n; ++i) {
+        auto [ec, len] = co_await boost::asio::async_read(socket, boost::asio::buffer(in), use_resume);
+        if (ec) {
+            ++detail::errors;
+            break;
+        }
+        check(rpc::decode_response(in), i);
+    }
+}
+
+await_return_object<> tcp_pingpong(tcp::socket& socket, std::size_t n) {
+    for (std::uint32_t i = 0; i < n; ++i) {
+        unsigned char out[rpc::request_size];
+        unsigned char in[rpc::response_size];
+        rpc::encode(rpc::request{i, 2, 3, static_cast<std::int32_t>(i)}, out);
+        auto [wec, wn] = co_await boost::asio::async_write(socket, boost::asio::buffer(out), use_resume);
+        auto [rec, rn] = co_await boost::asio::async_read(socket, boost::asio::buffer(in), use_resume);
+        if (wec || rec) {
+            ++detail::errors;
+            break;
+        }
+        check(rpc::decode_response(in), i);
+    }
+}
+
+void run_tcp(std::size_t n) {
+    io_context io;
+    tcp::acceptor acceptor(io, tcp::endpoint(boost::asio::ip::address_v4::loopback(), 0));
+    auto endpoint = acceptor.local_endpoint();
+
+    pid_t child = ::fork();
+    if (child == 0) {
+        io_context child_io;
+        tcp::socket socket(child_io);
+        socket.connect(endpoint);
+        socket.set_option(tcp::no_delay(true));
+        auto server = tcp_server(socket);
+        child_io.run();
+        ::_exit(0);
+    }
+
+    tcp::socket socket = acceptor.accept();
+    socket.set_option(tcp::no_delay(true));
+
+    bench::report(std::cout, bench::measure("tcp/pingpong", n, [&](std::size_t k) {
+                auto coro = tcp_pingpong(socket, k);
+                io.run();
+                io.restart();
+            }));
+    bench::report(std::cout, bench::measure("tcp/pipelined", n, [&](std::size_t k) {
+                auto sender = tcp_send_all(socket, k);
+                auto receiver = tcp_receive_all(socket, k);
+                io.run();
+                io.restart();
+            }));
+
+    socket.close();
+    ::waitpid(child, nullptr, 0);
+}
+
+int main(int argc, char** argv) {
+    std::size_t n = bench::iterations(argc, argv, 100000);
+    run_shm(n);
+    run_tcp(n);
+    if (detail::errors != 0) {
+        std::cerr << detail::errors << " wrong or missing responses\n";
+        return 1;
+    }
+}
@@ -0,0 +1,343 @@
+// A shared-memory message ring between processes, with awaitable send and receive
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SHM_RING_HPP
+#define SHM_RING_HPP
+
+// Messages are written directly into slots in memory shared by the two
+// processes, and read from there in place: no copies through the kernel.
+// The ring is a bounded multi-producer, single-consumer queue with a sequence
+// number per slot (after Dmitry Vyukov's design), so a single producer is the
+// SPSC case at no extra cost.
+//
+// When a receiver finds the ring empty (or a sender finds it full) its coroutine
+// parks: it sets a flag in shared memory and waits, through Asio, for an eventfd
+// to become readable. The other side only writes to the eventfd if it sees
+// that flag, so while both sides are busy no system calls are made at all.
+//
+// Linux only (eventfd). Create the region and the doorbells before fork();
+// each process then makes its own shm_sender/shm_receiver on its own io_context.
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <experimental/coroutine>
+
+#include <sys/eventfd.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include <boost/asio/io_context.hpp>
+#include <boost/asio/posix/stream_descriptor.hpp>
+
+//
+// The part that lives in shared memory
+//
+
+template<typename T, std::size_t Capacity>
+struct shm_ring {
+    static_assert(std::is_trivially_copyable_v<T>, "messages are shared between address spaces");
+    static_assert(Capacity != 0 && (Capacity & (Capacity - 1)) == 0, "capacity must be a power of two");
+    static_assert(std::atomic<std::uint64_t>::is_always_lock_free, "atomics must be address-free");
+
+    shm_ring() {
+        for (std::size_t i = 0; i < Capacity; ++i) {
+            slots_[i].seq.store(i, std::memory_order_relaxed);
+        }
+    }
+
+    // producers: reserve the next free slot; false if the ring is full
+    bool try_claim(std::uint64_t& pos) noexcept {
+        pos = tail_.load(std::memory_order_relaxed);
+        while (true) {
+            auto seq = slots_[pos & mask].seq.load(std::memory_order_acquire);
+            auto diff = static_cast<std::int64_t>(seq - pos);
+            if (diff == 0) {
+                if (tail_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    return true;
+                }
+            } else if (diff < 0) {
+                return false;
+            } else {
+                pos = tail_.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // make a claimed slot visible to the consumer; true if the consumer needs waking
+    bool publish(std::uint64_t pos) noexcept {
+        slots_[pos & mask].seq.store(pos + 1, std::memory_order_release);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return consumer_parked_.load(std::memory_order_relaxed) != 0;
+    }
+
+    // consumer: is there a message at the head?
+    bool ready() const noexcept {
+        auto pos = head_.load(std::memory_order_relaxed);
+        return slots_[pos & mask].seq.load(std::memory_order_acquire) == pos + 1;
+    }
+
+    T& front() noexcept {
+        return slots_[head_.load(std::memory_order_relaxed) & mask].value;
+    }
+
+    T& value_at(std::uint64_t pos) noexcept {
+        return slots_[pos & mask].value;
+    }
+
+    // give the head slot back to the producers; true if a producer needs waking
+    bool release() noexcept {
+        auto pos = head_.load(std::memory_order_relaxed);
+        slots_[pos & mask].seq.store(pos + Capacity, std::memory_order_release);
+        head_.store(pos + 1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        return producers_parked_.load(std::memory_order_relaxed) != 0;
+    }
+
+    // set by a side that is about to wait on its eventfd
+    std::atomic<std::uint32_t> consumer_parked_{0};
+    std::atomic<std::uint32_t> producers_parked_{0};
+
+private:
+    static constexpr std::uint64_t mask = Capacity - 1;
+
+    struct slot {
+        std::atomic<std::uint64_t> seq;
+        T value;
+    };
+
+    // keep the producer and consumer indices on separate cache lines
+    alignas(64) std::atomic<std::uint64_t> tail_{0};
+    alignas(64) std::atomic<std::uint64_t> head_{0};
+    alignas(64) slot slots_[Capacity];
+};
+
+//
+// An anonymous shared mapping, inherited across fork()
+//
+
+struct shm_region {
+    explicit shm_region(std::size_t size) : size_(size) {
+        addr_ = ::mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+        if (addr_ == MAP_FAILED) {
+            throw std::runtime_error("mmap failed");
+        }
+    }
+    shm_region(shm_region const&) = delete;
+    ~shm_region() { ::munmap(addr_, size_); }
+
+    template<typename Ring>
+    Ring* construct(std::size_t offset = 0) {
+        return new (static_cast<char*>(addr_) + offset) Ring;
+    }
+
+private:
+    void* addr_;
+    std::size_t size_;
+};
+
+// the eventfds used to wake a parked peer: one for "data available"
+// (single consumer, so it is simply drained) and one for "space available"
+// (possibly many producers, so a semaphore: each wakeup is taken by one)
+struct shm_doorbells {
+    int data_fd;
+    int space_fd;
+
+    static shm_doorbells create() {
+        shm_doorbells d{::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC),
+                        ::eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC | EFD_SEMAPHORE)};
+        if (d.data_fd < 0 || d.space_fd < 0) {
+            throw std::runtime_error("eventfd failed");
+        }
+        return d;
+    }
+
+    static void ring(int fd) noexcept {
+        std::uint64_t one = 1;
+        [[maybe_unused]] auto n = ::write(fd, &one, sizeof(one));
+    }
+
+    static void drain(int fd) noexcept {
+        std::uint64_t count;
+        [[maybe_unused]] auto n = ::read(fd, &count, sizeof(count));
+    }
+};
+
+//
+// Process-local endpoints with the awaitables
+//
+
+// A claimed, not yet published slot: fill in *value in place, then publish it
+template<typename T>
+struct shm_slot {
+    std::uint64_t pos;
+    T* value;
+};
+
+template<typename T, std::size_t Capacity>
+struct shm_sender {
+    using ring_t = shm_ring<T, Capacity>;
+
+    shm_sender(boost::asio::io_context& io, ring_t& ring, shm_doorbells bells)
+        : ring_(ring), bells_(bells), space_(io, ::dup(bells.space_fd)) {}
+
+    // wait for a free slot and return it, for writing the message in place
+    struct claim_awaiter {
+        shm_sender* sender_;
+        shm_slot<T> slot_;
+        std::experimental::coroutine_handle<> coro_;
+
+        bool await_ready() noexcept { return sender_->ring_.try_claim(slot_.pos); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+            coro_ = coro;
+            sender_->ring_.producers_parked_.fetch_add(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);    // pairs with the one in release()
+            if (sender_->ring_.try_claim(slot_.pos)) {
+                // space appeared while we were parking
+                sender_->ring_.producers_parked_.fetch_sub(1, std::memory_order_relaxed);
+                return false;
+            }
+            wait();
+            return true;
+        }
+
+        shm_slot<T> await_resume() noexcept {
+            slot_.value = &sender_->ring_.value_at(slot_.pos);
+            return slot_;
+        }
+
+    private:
+        void wait() {
+            sender_->space_.async_wait(
+                boost::asio::posix::stream_descriptor::wait_read,
+                [this](boost::system::error_code ec) {
+                    if (ec) {
+                        return;     // shutting down; the coroutine is destroyed with its owner
+                    }
+                    shm_doorbells::drain(sender_->bells_.space_fd);
+                    if (sender_->ring_.try_claim(slot_.pos)) {
+                        sender_->ring_.producers_parked_.fetch_sub(1, std::memory_order_relaxed);
+                        coro_.resume();
+                    } else {
+                        wait();     // another producer got there first
+                    }
+                });
+        }
+    };
+
+    claim_awaiter claim() noexcept { return claim_awaiter{this, {}, {}}; }
+
+    void publish(shm_slot<T> slot) noexcept {
+        if (ring_.publish(slot.pos)) {
+            shm_doorbells::ring(bells_.data_fd);
+        }
+    }
+
+    // the convenient form: claim, copy the message in, and publish
+    struct send_awaiter : claim_awaiter {
+        T msg_;
+        void await_resume() noexcept {
+            auto slot = claim_awaiter::await_resume();
+            *slot.value = msg_;
+            this->sender_->publish(slot);
+        }
+    };
+
+    send_awaiter send(T const& msg) noexcept { return send_awaiter{{this, {}, {}}, msg}; }
+
+private:
+    ring_t& ring_;
+    shm_doorbells bells_;
+    boost::asio::posix::stream_descriptor space_;
+};
+
+template<typename T, std::size_t Capacity>
+struct shm_receiver {
+    using ring_t = shm_ring<T, Capacity>;
+
+    shm_receiver(boost::asio::io_context& io, ring_t& ring, shm_doorbells bells)
+        : ring_(ring), bells_(bells), data_(io, ::dup(bells.data_fd)) {}
+
+    // wait for a message; the result refers to it in place, in shared memory,
+    // and is valid until release()
+    struct receive_awaiter {
+        shm_receiver* receiver_;
+        std::experimental::coroutine_handle<> coro_;
+
+        bool await_ready() const noexcept { return receiver_->ring_.ready(); }
+
+        template<typename P>
+        bool await_suspend(std::experimental::coroutine_handle<P> coro) {
+            coro_ = coro;
+            receiver_->ring_.consumer_parked_.store(1, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);    // pairs with the one in publish()
+            if (receiver_->ring_.ready()) {
+                receiver_->ring_.consumer_parked_.store(0, std::memory_order_relaxed);
+                return false;
+            }
+            wait();
+            return true;
+        }
+
+        T& await_resume() noexcept { return receiver_->ring_.front(); }
+
+    private:
+        void wait() {
+            receiver_->data_.async_wait(
+                boost::asio::posix::stream_descriptor::wait_read,
+                [this](boost::system::error_code ec) {
+                    if (ec) {
+                        return;
+                    }
+                    shm_doorbells::drain(receiver_->bells_.data_fd);
+                    if (receiver_->ring_.ready()) {
+                        receiver_->ring_.consumer_parked_.store(0, std::memory_order_relaxed);
+                        coro_.resume();
+                    } else {
+                        wait();
+                    }
+                });
+        }
+    };
+
+    receive_awaiter receive() noexcept { return receive_awaiter{this, {}}; }
+
+    // done with the message from the last receive()
+    void release() noexcept {
+        if (ring_.release()) {
+            shm_doorbells::ring(bells_.space_fd);
+        }
+    }
+
+private:
+    ring_t& ring_;
+    shm_doorbells bells_;
+    boost::asio::posix::stream_descriptor data_;
+};
+
+#endif // SHM_RING_HPP
@@ -0,0 +1,157 @@
+// Blocking a thread until an awaitable completes
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef SYNC_WAIT_HPP
+#define SYNC_WAIT_HPP
+
+// auto result = sync_wait(awaitable);
+//
+// For the edge of a program (main, a test, a benchmark) that is not a
+// coroutine itself: co_awaits the awaitable in a small coroutine of its own
+// and blocks until that completes, wherever it completes. The waiting
+// thread is released only once the coroutine has suspended for the last
+// time, so nothing is still running in its frame when it is destroyed.
+// Exceptions are rethrown here.
+
+#include <condition_variable>
+#include <exception>
+#include <mutex>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <experimental/coroutine>
+
+#include "frame_stats.hpp"
+
+namespace detail {
+
+template<typename A, typename = void>
+struct awaiter_of {
+    using type = A&&;
+};
+
+template<typename A>
+struct awaiter_of<A, std::void_t<decltype(std::declval<A>().operator co_await())>> {
+    using type = decltype(std::declval<A>().operator co_await());
+};
+
+template<typename A>
+using await_result_t = decltype(std::declval<typename awaiter_of<A>::type>().await_resume());
+
+struct sync_wait_event {
+    void set() {
+        std::lock_guard<std::mutex> lock(mutex_);
+        done_ = true;
+        cv_.notify_all();
+    }
+
+    void wait() {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cv_.wait(lock, [this]() { return done_; });
+    }
+
+private:
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    bool done_ = false;
+};
+
+template<typename T>
+struct sync_wait_result {
+    std::optional<std::decay_t<T>> value_;
+
+    void return_value(T&& v) { value_.emplace(std::forward<T>(v)); }
+    std::decay_t<T> get() { return std::move(*value_); }
+};
+
+template<>
+struct sync_wait_result<void> {
+    void return_void() const noexcept {}
+    void get() const noexcept {}
+};
+
+template<typename T>
+struct sync_wait_task {
+    struct promise_type : sync_wait_result<T>, frame_stats::accounted<promise_type> {
+        sync_wait_event* event_ = nullptr;
+        std::exception_ptr error_;
+
+        auto initial_suspend() const noexcept { return std::experimental::suspend_always(); }
+
+        // tell the waiting thread only once we are suspended
+        struct final_awaiter {
+            bool await_ready() const noexcept { return false; }
+            void await_suspend(std::experimental::coroutine_handle<promise_type> coro) noexcept {
+                coro.promise().event_->set();
+            }
+            void await_resume() const noexcept {}
+        };
+        final_awaiter final_suspend() const noexcept { return {}; }
+
+        void unhandled_exception() { error_ = std::current_exception(); }
+
+        sync_wait_task get_return_object() {
+            return sync_wait_task(std::experimental::coroutine_handle<promise_type>::from_promise(*this));
+        }
+    };
+
+    explicit sync_wait_task(std::experimental::coroutine_handle<promise_type> coro) : coro_(coro) {}
+    sync_wait_task(sync_wait_task const&) = delete;
+    ~sync_wait_task() { coro_.destroy(); }
+
+    decltype(auto) run() {
+        sync_wait_event event;
+        coro_.promise().event_ = &event;
+        coro_.resume();
+        event.wait();
+        if (coro_.promise().error_) {
+            std::rethrow_exception(coro_.promise().error_);
+        }
+        return coro_.promise().get();
+    }
+
+private:
+    std::experimental::coroutine_handle<promise_type> coro_;
+};
+
+// The awaitable is awaited where it is, through a reference: it outlives
+// the wait (it is sync_wait's argument), and many awaitables can't be moved
+template<typename A>
+sync_wait_task<await_result_t<A&>> make_sync_wait_task(A& a, std::false_type /* void */) {
+    co_return co_await a;
+}
+
+template<typename A>
+sync_wait_task<void> make_sync_wait_task(A& a, std::true_type /* void */) {
+    co_await a;
+}
+
+}
+
+template<typename Awaitable>
+decltype(auto) sync_wait(Awaitable&& a) {
+    using result_t = detail::await_result_t<Awaitable&>;
+    return detail::make_sync_wait_task(a, std::is_void<result_t>()).run();
+}
+
+#endif // SYNC_WAIT_HPP
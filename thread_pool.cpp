@@ -0,0 +1,342 @@
+// Implementation of thread_pool
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#include "thread_pool.hpp"
+
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <iterator>
+
+#ifdef __linux__
+#include <fcntl.h>
+#include <pthread.h>
+#include <sched.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+thread_local thread_pool::worker* thread_pool::current_ = nullptr;
+
+namespace {
+
+std::size_t hardware_threads() {
+    return std::max(1u, std::thread::hardware_concurrency());
+}
+
+// Whether the thread is waiting for something (sleeping, in I/O...) rather
+// than running or ready to run. False if we can't tell. Its CPU time won't
+// do: on a busy machine a thread that is ready to run may get little of it.
+bool waiting(long tid) {
+#ifdef __linux__
+    if (tid == 0) {
+        return false;
+    }
+    char path[64];
+    std::snprintf(path, sizeof(path), "/proc/self/task/%ld/stat", tid);
+    int fd = ::open(path, O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    char buf[256];
+    auto n = ::read(fd, buf, sizeof(buf) - 1);
+    ::close(fd);
+    if (n <= 0) {
+        return false;
+    }
+    buf[n] = '\0';
+    // "tid (name) S ...": the state follows the name, which may contain anything
+    char const* paren = std::strrchr(buf, ')');
+    return paren && paren[1] == ' ' && paren[2] != 'R' && paren[2] != '\0';
+#else
+    (void)tid;
+    return false;
+#endif
+}
+
+}
+
+thread_pool::thread_pool(std::size_t threads, std::vector<unsigned> cpus) : cpus_(std::move(cpus)) {
+    if (threads == 0) {
+        threads = cpus_.empty() ? hardware_threads() : cpus_.size();
+    }
+    concurrency_ = threads;
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (std::size_t i = 0; i < threads; ++i) {
+        start_worker();
+    }
+}
+
+thread_pool::thread_pool(elastic options) : cpus_(options.cpus), elastic_(true), options_(std::move(options)) {
+    if (options_.max_threads == 0) {
+        options_.max_threads = cpus_.empty() ? hardware_threads() : cpus_.size();
+    }
+    options_.max_threads = std::max({options_.max_threads, options_.min_threads, std::size_t(1)});
+    concurrency_ = options_.max_threads;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        for (std::size_t i = 0; i < options_.min_threads; ++i) {
+            start_worker();
+        }
+    }
+    supervisor_ = std::thread([this]() { supervise(); });
+}
+
+thread_pool::~thread_pool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stopping_ = true;
+        if (head_ && live_.load(std::memory_order_relaxed) == 0) {
+            start_worker();     // an elastic pool that had shrunk to nothing
+        }
+    }
+    wake_.notify_all();
+    tick_.notify_all();
+    if (supervisor_.joinable()) {
+        supervisor_.join();
+    }
+    // only the supervisor removes workers, so the list is ours now
+    for (auto& w : workers_) {
+        w.thread_.join();
+    }
+}
+
+void thread_pool::post_list(task* first, task* last, std::size_t n) {
+    if (elastic_) {
+        auto now = clock::now();
+        for (task* t = first; ; t = t->next_) {
+            t->queued_ = now;
+            if (t == last) {
+                break;
+            }
+        }
+    }
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        (tail_ ? tail_->next_ : head_) = first;
+        tail_ = last;
+    }
+    if (n == 1) {
+        wake_.notify_one();
+    } else {
+        wake_.notify_all();
+    }
+}
+
+void thread_pool::start_worker() {
+    workers_.emplace_back();
+    worker& w = workers_.back();
+    w.pool_ = this;
+    w.seen_at_ = clock::now();
+    live_.fetch_add(1, std::memory_order_relaxed);
+    w.thread_ = std::thread([this, &w]() { work(&w); });
+}
+
+// How many workers look stuck; also brings our view of their progress up to date.
+// One that has been in the same task for a while only counts if it was waiting
+// when supervise() last looked: a long computation keeps its place under
+// max_threads.
+std::size_t thread_pool::blocked(clock::time_point now) {
+    std::size_t n = 0;
+    for (auto& w : workers_) {
+        if (w.exited_) {
+            continue;
+        }
+        if (w.declared_blocked_) {
+            ++n;
+        } else if (!w.busy_ || w.runs_ != w.seen_runs_) {
+            w.seen_runs_ = w.runs_;
+            w.seen_at_ = now;
+            w.waiting_ = false;
+        } else if (options_.blocked_after.count() != 0 &&
+                   now - w.seen_at_ > options_.blocked_after && w.waiting_) {
+            ++n;
+        }
+    }
+    return n;
+}
+
+// Blocked workers don't count against max_threads, but we won't replace
+// more than max_threads of them: past that, more threads are unlikely to help
+bool thread_pool::room_for_one_more(std::size_t blocked) const {
+    auto live = live_.load(std::memory_order_relaxed);
+    return !stopping_ && live - std::min(blocked, live) < options_.max_threads &&
+        live < 2 * options_.max_threads;
+}
+
+bool thread_pool::pin_this_thread(std::vector<unsigned> const& cpus) noexcept {
+#ifdef __linux__
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (auto cpu : cpus) {
+        if (cpu < CPU_SETSIZE) {
+            CPU_SET(cpu, &set);
+        }
+    }
+    return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+    (void)cpus;
+    return false;
+#endif
+}
+
+void thread_pool::work(worker* self) {
+    current_ = self;
+    if (!cpus_.empty()) {
+        // failure (e.g. a restricted cpuset) just leaves the thread unpinned
+        pin_this_thread(cpus_);
+    }
+    std::unique_lock<std::mutex> lock(mutex_);
+#ifdef __linux__
+    self->tid_ = ::syscall(SYS_gettid);
+#endif
+    auto ready = [this]() { return head_ || stopping_; };
+    while (true) {
+        if (!ready()) {
+            if (!elastic_) {
+                wake_.wait(lock, ready);
+            } else {
+                ++idle_;
+                bool woken = wake_.wait_for(lock, options_.idle_decay, ready);
+                --idle_;
+                if (!woken && live_.load(std::memory_order_relaxed) > options_.min_threads) {
+                    break;      // not needed any more
+                }
+                continue;
+            }
+        }
+        if (!head_) {
+            break;      // stopping, and nothing left to do
+        }
+        task* t = head_;
+        head_ = t->next_;
+        if (!head_) {
+            tail_ = nullptr;
+        }
+        self->busy_ = true;
+        lock.unlock();
+        t->run_(t);
+        lock.lock();
+        self->busy_ = false;
+        ++self->runs_;
+    }
+    self->exited_ = true;
+    live_.fetch_sub(1, std::memory_order_relaxed);
+}
+
+void thread_pool::supervise() {
+    // look a few times per target wait, but not absurdly often
+    auto period = std::max<clock::duration>(options_.target_wait / 2, std::chrono::microseconds(100));
+    // workers in a long task, whose thread state we read with the lock released
+    struct suspect {
+        worker* w;
+        long tid;
+        std::size_t runs;
+        bool waiting;
+    };
+    std::vector<suspect> suspects;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stopping_) {
+        tick_.wait_for(lock, period);
+        if (stopping_) {
+            break;
+        }
+        auto now = clock::now();
+        blocked(now);       // only to bring seen_runs_ and seen_at_ up to date
+
+        // Reading the state takes three system calls, so not with everyone else
+        // waiting for the lock, and for each worker at most a few times per
+        // blocked_after. Only we remove workers, so the pointers stay good.
+        suspects.clear();
+        if (options_.blocked_after.count() != 0) {
+            for (auto& w : workers_) {
+                if (!w.exited_ && !w.declared_blocked_ && w.busy_ && w.runs_ == w.seen_runs_ &&
+                    now - w.seen_at_ > options_.blocked_after &&
+                    now - w.state_read_at_ >= clock::duration(options_.blocked_after) / 4) {
+                    w.state_read_at_ = now;
+                    suspects.push_back(suspect{&w, w.tid_, w.runs_, false});
+                }
+            }
+        }
+        if (!suspects.empty()) {
+            lock.unlock();
+            for (auto& s : suspects) {
+                s.waiting = waiting(s.tid);
+            }
+            lock.lock();
+            for (auto const& s : suspects) {
+                if (s.w->runs_ == s.runs) {     // still in the same task
+                    s.w->waiting_ = s.waiting;
+                }
+            }
+            now = clock::now();
+        }
+
+        auto stuck = blocked(now);
+        // is the oldest task overdue, with nobody free to take it?
+        if (head_ && idle_ == 0 && now - head_->queued_ > options_.target_wait &&
+            room_for_one_more(stuck)) {
+            start_worker();
+        }
+
+        // reap workers that have exited
+        std::list<worker> gone;
+        for (auto it = workers_.begin(); it != workers_.end(); ) {
+            auto next = std::next(it);
+            if (it->exited_) {
+                gone.splice(gone.end(), workers_, it);
+            }
+            it = next;
+        }
+        if (!gone.empty()) {
+            lock.unlock();
+            for (auto& w : gone) {
+                w.thread_.join();
+            }
+            lock.lock();
+        }
+    }
+}
+
+thread_pool::blocking_scope::blocking_scope() {
+    worker* w = current_;
+    if (!w || !w->pool_->elastic_) {
+        return;
+    }
+    thread_pool* pool = w->pool_;
+    std::lock_guard<std::mutex> lock(pool->mutex_);
+    outer_ = std::exchange(w->declared_blocked_, true);
+    // don't wait for the supervisor if work is already queued behind us
+    if (pool->head_ && pool->idle_ == 0 && pool->room_for_one_more(pool->blocked(clock::now()))) {
+        pool->start_worker();
+    }
+}
+
+thread_pool::blocking_scope::~blocking_scope() {
+    worker* w = current_;
+    if (!w || !w->pool_->elastic_) {
+        return;
+    }
+    std::lock_guard<std::mutex> lock(w->pool_->mutex_);
+    w->declared_blocked_ = outer_;
+}
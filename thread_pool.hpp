@@ -0,0 +1,203 @@
+// A fixed set of worker threads running intrusively queued tasks
+/*
+Copyright (c) 2018 Jeff Trull <edaskel@att.net>
+
+Permission is hereby granted, free of charge, to any person obtaining a copy
+of this software and associated documentation files (the "Software"), to deal
+in the Software without restriction, including without limitation the rights
+to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+copies of the Software, and to permit persons to whom the Software is
+furnished to do so, subject to the following conditions:
+
+The above copyright notice and this permission notice shall be included in all
+copies or substantial portions of the Software.
+
+THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+SOFTWARE.
+*/
+
+#ifndef THREAD_POOL_HPP
+#define THREAD_POOL_HPP
+
+// Tasks are linked through themselves (they usually live in a coroutine
+// frame or an awaiter), so queueing one allocates nothing. The queue is a
+// single list under a mutex: the work we give the pool comes in chunks big
+// enough that this is not where the time goes.
+//
+// co_await pool.schedule() moves a coroutine onto a pool thread.
+//
+// A pool is either fixed, with the same threads from construction to
+// destruction, or elastic: a supervisor thread adds a worker whenever the
+// oldest queued task has waited longer than a target, and a worker that
+// finds nothing to do for a while goes away, all within configured bounds.
+// Workers that are stuck in one task (blocked in a system call, say) don't
+// count against the upper bound, so they are replaced rather than left to
+// hold the queue up. Code that knows it is about to block can say so with a
+// blocking_scope. Otherwise, on Linux, the supervisor spots a worker that has
+// been in one task for a while and whose thread is waiting rather than
+// runnable; one that is busy computing isn't stuck, and isn't replaced.
+// Elsewhere only blocking_scope counts.
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+#include <experimental/coroutine>
+
+struct thread_pool {
+    using clock = std::chrono::steady_clock;
+
+    struct task {
+        task* next_ = nullptr;
+        void (*run_)(task*);
+        clock::time_point queued_;      // elastic pools only
+
+        explicit task(void (*run)(task*)) : run_(run) {}
+    };
+
+    struct elastic {
+        std::size_t min_threads = 1;
+        std::size_t max_threads = 0;    // zero means one per hardware thread
+        // grow while the oldest queued task has waited longer than this
+        std::chrono::microseconds target_wait{1000};
+        // a worker idle for this long exits, unless we are at min_threads
+        std::chrono::milliseconds idle_decay{10000};
+        // a worker that has been in one task for this long, and is waiting,
+        // is taken to be blocked; zero leaves that to blocking_scope alone
+        std::chrono::milliseconds blocked_after{20};
+        // if not empty, the CPUs the workers may run on
+        std::vector<unsigned> cpus;
+    };
+
+    // fixed size; zero means one per hardware thread (or per CPU in cpus)
+    explicit thread_pool(std::size_t threads = 0, std::vector<unsigned> cpus = {});
+    explicit thread_pool(elastic options);
+    thread_pool(thread_pool const&) = delete;
+
+    // runs whatever is still queued, then stops the threads
+    ~thread_pool();
+
+    // threads running right now
+    std::size_t size() const noexcept { return live_.load(std::memory_order_relaxed); }
+
+    // how many threads to plan work for: the fixed size, or an elastic pool's maximum
+    std::size_t concurrency() const noexcept { return concurrency_; }
+
+    // restrict the calling thread to these CPUs; false if that isn't possible
+    static bool pin_this_thread(std::vector<unsigned> const& cpus) noexcept;
+
+    // Declares the enclosing code on a pool thread to be about to block,
+    // so an elastic pool can start a replacement right away if work is
+    // waiting. Does nothing on other threads or in a fixed pool.
+    struct blocking_scope {
+        blocking_scope();
+        ~blocking_scope();
+        blocking_scope(blocking_scope const&) = delete;
+
+    private:
+        bool outer_ = false;    // already inside another one
+    };
+
+    void post(task* t) {
+        t->next_ = nullptr;
+        post_list(t, t, 1);
+    }
+
+    // a list of n tasks already linked through next_, queued in one go
+    void post_list(task* first, task* last, std::size_t n);
+
+    // a callable, in a task allocated for it
+    template<typename F, typename = std::enable_if_t<!std::is_convertible_v<F, task*>>>
+    void post(F f) {
+        struct holder : task {
+            explicit holder(F&& fn) : task(&run), f_(std::move(fn)) {}
+            static void run(task* t) {
+                auto self = static_cast<holder*>(t);
+                self->f_();
+                delete self;
+            }
+            F f_;
+        };
+        post(new holder(std::move(f)));
+    }
+
+    struct schedule_awaiter : task {
+        thread_pool* pool_;
+        std::experimental::coroutine_handle<> coro_;
+
+        explicit schedule_awaiter(thread_pool* p) : task(&resume), pool_(p) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(std::experimental::coroutine_handle<> coro) {
+            coro_ = coro;
+            pool_->post(this);
+        }
+
+        void await_resume() const noexcept {}
+
+    private:
+        static void resume(task* t) {
+            static_cast<schedule_awaiter*>(t)->coro_.resume();
+        }
+    };
+
+    schedule_awaiter schedule() { return schedule_awaiter(this); }
+
+private:
+    struct worker {
+        thread_pool* pool_;
+        std::thread thread_;
+        bool busy_ = false;
+        bool declared_blocked_ = false;
+        bool exited_ = false;
+        long tid_ = 0;                  // on Linux, for the thread's scheduler state
+        std::size_t runs_ = 0;          // tasks finished
+        // the supervisor's last look at runs_
+        std::size_t seen_runs_ = 0;
+        clock::time_point seen_at_;
+        // and at the thread's state, while in one long task
+        bool waiting_ = false;
+        clock::time_point state_read_at_;
+    };
+
+    // with mutex_ held
+    void start_worker();
+    std::size_t blocked(clock::time_point now);
+    bool room_for_one_more(std::size_t blocked) const;
+
+    void work(worker* self);
+    void supervise();
+
+    std::mutex mutex_;
+    std::condition_variable wake_;
+    task* head_ = nullptr;
+    task* tail_ = nullptr;
+    bool stopping_ = false;
+    std::list<worker> workers_;
+    std::atomic<std::size_t> live_{0};
+    std::size_t concurrency_;
+    std::vector<unsigned> cpus_;
+
+    // elastic pools only
+    bool elastic_ = false;
+    elastic options_;
+    std::size_t idle_ = 0;
+    std::condition_variable tick_;
+    std::thread supervisor_;
+
+    static thread_local worker* current_;
+};
+
+#endif // THREAD_POOL_HPP